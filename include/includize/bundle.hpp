@@ -0,0 +1,398 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_BUNDLE_HPP
+#define INCLUDIZE_BUNDLE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "memory_streambuf.hpp"
+#include "resolver.hpp"
+
+// A bundle packs a whole tree of files into a single file that is mapped
+// into memory once, after which includes are served from it without any
+// syscalls.  All integers are little-endian.
+//
+//     offset  size
+//          0     8  magic, "INCLZBDL"
+//          8     4  version, 1
+//         12     4  number of files
+//         16    32  index entry for each file, sorted by name:
+//                     8  offset of the name
+//                     8  size of the name
+//                     8  offset of the contents
+//                     8  size of the contents
+//                   names
+//                   contents, starting on a page boundary, each file
+//                   aligned to 16 bytes
+
+namespace includize
+{
+class bundle_resolver : public resolver
+{
+public:
+    using resolver::list;
+    using resolver::open;
+
+    // Maps the bundle |file_name|.  Use is_open() to find out whether that
+    // worked.
+    explicit bundle_resolver(const std::string &file_name)
+        : mapping_(map(file_name)), count_(0)
+    {
+        if (mapping_ && mapping_->size >= header_size() &&
+            std::memcmp(mapping_->data, magic(), 8) == 0 &&
+            read_u32(mapping_->data + 8) == 1)
+        {
+            count_ = read_u32(mapping_->data + 12);
+
+            if (header_size() + count_ * entry_size() > mapping_->size)
+            {
+                count_ = 0;
+                mapping_.reset();
+            }
+        }
+        else
+        {
+            mapping_.reset();
+        }
+    }
+
+    bool is_open() const { return mapping_ != nullptr; }
+
+    std::size_t size() const { return count_; }
+
+    std::unique_ptr< std::streambuf > open(const std::string &name) override
+    {
+        if (!mapping_)
+        {
+            return nullptr;
+        }
+
+        const std::string key = normalize_path(name);
+        const std::size_t i = lower_bound(key);
+
+        if (i == count_ || compare(entry(i), key) != 0)
+        {
+            return nullptr;
+        }
+
+        const std::uint64_t offset = read_u64(entry(i) + 16);
+        const std::uint64_t size = read_u64(entry(i) + 24);
+
+        if (offset > mapping_->size || size > mapping_->size - offset)
+        {
+            return nullptr;
+        }
+
+        return std::unique_ptr< std::streambuf >(
+            new memory_streambuf(mapping_->data + offset, size, mapping_));
+    }
+
+    std::vector< std::string > list(const std::string &path) override
+    {
+        std::vector< std::string > names;
+
+        if (!mapping_)
+        {
+            return names;
+        }
+
+        std::string prefix = normalize_path(path);
+
+        if (prefix.size() && *prefix.rbegin() != '/')
+        {
+            prefix += "/";
+        }
+
+        // the files in a directory are next to each other in the index
+        for (std::size_t i = lower_bound(prefix); i < count_; ++i)
+        {
+            const std::string name = name_of(entry(i));
+
+            if (name.compare(0, prefix.size(), prefix) != 0)
+            {
+                break;
+            }
+
+            if (name.find('/', prefix.size()) == std::string::npos)
+            {
+                names.push_back(name.substr(prefix.size()));
+            }
+        }
+
+        return names;
+    }
+
+private:
+    struct mapping
+    {
+        mapping(const char *d, std::size_t s) : data(d), size(s) {}
+
+        mapping(mapping &) = delete;
+
+        ~mapping()
+        {
+            if (size)
+            {
+                ::munmap(const_cast< char * >(data), size);
+            }
+        }
+
+        const char *data;
+        std::size_t size;
+    };
+
+    friend class bundle_writer;
+
+    static constexpr const char *magic() { return "INCLZBDL"; }
+    static constexpr std::size_t header_size() { return 16; }
+    static constexpr std::size_t entry_size() { return 32; }
+
+    static std::shared_ptr< const mapping > map(const std::string &file_name)
+    {
+        const int fd = ::open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+
+        struct stat st;
+        void *data = MAP_FAILED;
+
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            data = ::mmap(
+                nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        ::close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            return nullptr;
+        }
+
+        return std::make_shared< mapping >(static_cast< const char * >(data),
+                                           st.st_size);
+    }
+
+    const char *entry(std::size_t i) const
+    {
+        return mapping_->data + header_size() + i * entry_size();
+    }
+
+    // binary search of the sorted index, straight out of the mapping
+    std::size_t lower_bound(const std::string &key) const
+    {
+        std::size_t lo = 0;
+        std::size_t hi = count_;
+
+        while (lo < hi)
+        {
+            const std::size_t mid = lo + (hi - lo) / 2;
+
+            if (compare(entry(mid), key) < 0)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        return lo;
+    }
+
+    std::string name_of(const char *entry) const
+    {
+        const std::uint64_t offset = read_u64(entry);
+        const std::uint64_t size = read_u64(entry + 8);
+
+        if (offset > mapping_->size || size > mapping_->size - offset)
+        {
+            return std::string();
+        }
+
+        return std::string(mapping_->data + offset, size);
+    }
+
+    int compare(const char *entry, const std::string &key) const
+    {
+        const std::uint64_t offset = read_u64(entry);
+        const std::uint64_t size = read_u64(entry + 8);
+
+        if (offset > mapping_->size || size > mapping_->size - offset)
+        {
+            return 1;
+        }
+
+        const int cmp = std::memcmp(mapping_->data + offset,
+                                    key.data(),
+                                    std::min< std::size_t >(size, key.size()));
+
+        if (cmp != 0 || size == key.size())
+        {
+            return cmp;
+        }
+
+        return (size < key.size()) ? -1 : 1;
+    }
+
+    static std::uint32_t read_u32(const char *p)
+    {
+        const unsigned char *u = reinterpret_cast< const unsigned char * >(p);
+        return std::uint32_t(u[0]) | std::uint32_t(u[1]) << 8 |
+               std::uint32_t(u[2]) << 16 | std::uint32_t(u[3]) << 24;
+    }
+
+    static std::uint64_t read_u64(const char *p)
+    {
+        return std::uint64_t(read_u32(p)) |
+               std::uint64_t(read_u32(p + 4)) << 32;
+    }
+
+    std::shared_ptr< const mapping > mapping_;
+    std::size_t count_;
+};
+
+// Builds a bundle for bundle_resolver.
+class bundle_writer
+{
+public:
+    // Adds |contents| as |name|, which is normalized the same way names are
+    // when they are looked up.
+    void add(const std::string &name, std::string contents)
+    {
+        files_[normalize_path(name)] = std::move(contents);
+    }
+
+    std::size_t size() const { return files_.size(); }
+
+    // Writes the bundle to |file_name|, returning whether that worked.
+    bool write(const std::string &file_name) const
+    {
+        std::string out(bundle_resolver::magic(), 8);
+        append_u32(out, 1);
+        append_u32(out, static_cast< std::uint32_t >(files_.size()));
+
+        std::uint64_t name_offset = bundle_resolver::header_size() +
+                                    files_.size() *
+                                        bundle_resolver::entry_size();
+        std::uint64_t data_offset = name_offset;
+
+        for (std::map< std::string, std::string >::const_iterator it =
+                 files_.begin();
+             it != files_.end();
+             ++it)
+        {
+            data_offset += it->first.size();
+        }
+
+        data_offset = align(data_offset, page_size());
+
+        for (std::map< std::string, std::string >::const_iterator it =
+                 files_.begin();
+             it != files_.end();
+             ++it)
+        {
+            append_u64(out, name_offset);
+            append_u64(out, it->first.size());
+            append_u64(out, data_offset);
+            append_u64(out, it->second.size());
+
+            name_offset += it->first.size();
+            data_offset = align(data_offset + it->second.size(), 16);
+        }
+
+        for (std::map< std::string, std::string >::const_iterator it =
+                 files_.begin();
+             it != files_.end();
+             ++it)
+        {
+            out += it->first;
+        }
+
+        out.resize(align(out.size(), page_size()), '\0');
+
+        for (std::map< std::string, std::string >::const_iterator it =
+                 files_.begin();
+             it != files_.end();
+             ++it)
+        {
+            out += it->second;
+            out.resize(align(out.size(), 16), '\0');
+        }
+
+        std::ofstream file(file_name.c_str(),
+                           std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(out.data(), out.size());
+        return file.good();
+    }
+
+private:
+    static constexpr std::uint64_t page_size() { return 4096; }
+
+    static std::uint64_t align(std::uint64_t n, std::uint64_t to)
+    {
+        return (n + to - 1) / to * to;
+    }
+
+    static void append_u32(std::string &out, std::uint32_t n)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out += static_cast< char >((n >> (8 * i)) & 0xff);
+        }
+    }
+
+    static void append_u64(std::string &out, std::uint64_t n)
+    {
+        append_u32(out, static_cast< std::uint32_t >(n));
+        append_u32(out, static_cast< std::uint32_t >(n >> 32));
+    }
+
+    std::map< std::string, std::string > files_;
+};
+}
+
+#endif
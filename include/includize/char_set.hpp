@@ -0,0 +1,161 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_CHAR_SET_HPP
+#define INCLUDIZE_CHAR_SET_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace includize
+{
+// Finds the first of a set of characters.  Byte characters are compared 16
+// at a time where SSE2 is available.
+template < typename CHAR_T >
+class char_set
+{
+public:
+    using traits_type = std::char_traits< CHAR_T >;
+
+public:
+    explicit char_set(std::basic_string< CHAR_T > chars)
+        : chars_(std::move(chars))
+    {
+        std::sort(chars_.begin(), chars_.end());
+        chars_.erase(std::unique(chars_.begin(), chars_.end()), chars_.end());
+
+        std::memset(table_, 0, sizeof(table_));
+
+        for (CHAR_T c : chars_)
+        {
+            if (sizeof(CHAR_T) == 1 ||
+                static_cast< unsigned long >(c) < sizeof(table_))
+            {
+                table_[static_cast< unsigned char >(c)] = true;
+            }
+        }
+    }
+
+    bool contains(CHAR_T c) const
+    {
+        return traits_type::find(chars_.data(), chars_.size(), c) != nullptr;
+    }
+
+    const CHAR_T *find(const CHAR_T *begin, const CHAR_T *end) const
+    {
+        if (chars_.size() == 1)
+        {
+            return traits_type::find(begin, end - begin, chars_[0]);
+        }
+
+        return find(
+            begin, end, std::integral_constant< bool, sizeof(CHAR_T) == 1 >());
+    }
+
+private:
+    const CHAR_T *find(const CHAR_T *begin,
+                       const CHAR_T *end,
+                       std::true_type) const
+    {
+#ifdef __SSE2__
+        __m128i splats[16];
+        const std::size_t n = chars_.size();
+
+        if (n <= sizeof(splats) / sizeof(splats[0]))
+        {
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                splats[i] = _mm_set1_epi8(static_cast< char >(chars_[i]));
+            }
+
+            for (; end - begin >= 16; begin += 16)
+            {
+                const __m128i block = _mm_loadu_si128(
+                    reinterpret_cast< const __m128i * >(begin));
+                __m128i hits = _mm_cmpeq_epi8(block, splats[0]);
+
+                for (std::size_t i = 1; i < n; ++i)
+                {
+                    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, splats[i]));
+                }
+
+                const int mask = _mm_movemask_epi8(hits);
+
+                if (mask)
+                {
+                    return begin + __builtin_ctz(mask);
+                }
+            }
+        }
+#endif
+        for (; begin < end; ++begin)
+        {
+            if (table_[static_cast< unsigned char >(*begin)])
+            {
+                return begin;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const CHAR_T *find(const CHAR_T *begin,
+                       const CHAR_T *end,
+                       std::false_type) const
+    {
+        for (; begin < end; ++begin)
+        {
+            const bool hit =
+                (static_cast< unsigned long >(*begin) < sizeof(table_))
+                    ? table_[static_cast< unsigned char >(*begin)]
+                    : (traits_type::find(
+                           chars_.data(), chars_.size(), *begin) != nullptr);
+
+            if (hit)
+            {
+                return begin;
+            }
+        }
+
+        return nullptr;
+    }
+
+    std::basic_string< CHAR_T > chars_;
+    bool table_[256];
+};
+}
+
+#endif
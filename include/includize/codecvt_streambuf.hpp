@@ -0,0 +1,113 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_CODECVT_STREAMBUF_HPP
+#define INCLUDIZE_CODECVT_STREAMBUF_HPP
+
+#include <algorithm>
+#include <cwchar>
+#include <locale>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+#include "decoding_streambuf.hpp"
+
+namespace includize
+{
+// Decodes a stream of bytes into characters with the codecvt facet of a
+// locale, the way std::basic_filebuf does, but over any byte stream buffer.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_codecvt_streambuf
+    : public basic_decoding_streambuf< CHAR_T, TRAITS >
+{
+public:
+    using decoding_type = basic_decoding_streambuf< CHAR_T, TRAITS >;
+    using char_type = typename decoding_type::char_type;
+    using codecvt_type = std::codecvt< char_type, char, std::mbstate_t >;
+
+public:
+    basic_codecvt_streambuf(std::unique_ptr< std::streambuf > bytes,
+                            const std::locale &loc)
+        : decoding_type(
+              std::move(bytes), block_size(), block_size(), std::string())
+        , locale_(loc)
+        , codecvt_(&std::use_facet< codecvt_type >(locale_))
+        , state_()
+    {
+    }
+
+protected:
+    // Bytes the facet cannot convert are never consumed, so the stream ends
+    // once they fill the buffer.
+    std::size_t decode(const unsigned char *in,
+                       std::size_t size,
+                       bool final,
+                       char_type *out,
+                       std::size_t &produced) override
+    {
+        (void)final;
+
+        const char *from = reinterpret_cast< const char * >(in);
+        const char *from_next = from;
+        char_type *to_next = out;
+
+        if (codecvt_->in(state_,
+                         from,
+                         from + size,
+                         from_next,
+                         out,
+                         out + block_size(),
+                         to_next) == std::codecvt_base::noconv)
+        {
+            const std::size_t n = std::min(size, block_size());
+
+            std::copy(from, from + n, out);
+            from_next = from + n;
+            to_next = out + n;
+        }
+
+        produced = to_next - out;
+        return from_next - from;
+    }
+
+    // The conversion state is only known from the start of the stream.
+    void restart() override { state_ = std::mbstate_t(); }
+
+private:
+    static constexpr std::size_t block_size() { return 8192; }
+
+    std::locale locale_;
+    const codecvt_type *codecvt_;
+    std::mbstate_t state_;
+};
+}
+
+#endif
@@ -0,0 +1,255 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_CONTENT_CACHE_HPP
+#define INCLUDIZE_CONTENT_CACHE_HPP
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace includize
+{
+// Contents made from included files, such as the instantiations of
+// templates, and what is known about the files, kept so that they are only
+// made or found out once.  A cache can be shared by several streams, also on
+// different threads.  Everything is kept for an owner, such as the resolver
+// the files came from or the memory they are in, and only holds for as long
+// as that owner is alive, so streams that share a cache get the same answers
+// only when they read the same files.
+class content_cache
+{
+public:
+    content_cache() : contents_limit_(min_limit()), plain_limit_(min_limit())
+    {
+    }
+
+    // Returns nullptr if there is nothing for |key| made for |owner|.  The
+    // key must tell apart contents of different types.
+    template < typename CONTENTS >
+    std::shared_ptr< const CONTENTS > find(
+        const std::string &key,
+        const std::shared_ptr< const void > &owner) const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        std::unordered_map< std::string, contents_entry >::const_iterator it =
+            contents_.find(key);
+
+        if (it == contents_.end() || !same_owner(it->second.owner, owner))
+        {
+            return nullptr;
+        }
+
+        return std::static_pointer_cast< const CONTENTS >(it->second.contents);
+    }
+
+    // Keeps |contents| for |key| and |owner| unless there already are
+    // contents for them, and returns the contents that are kept.
+    template < typename CONTENTS >
+    std::shared_ptr< const CONTENTS > insert(
+        const std::string &key,
+        const std::shared_ptr< const void > &owner,
+        std::shared_ptr< const CONTENTS > contents)
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        forget_expired(contents_, contents_limit_);
+        contents_entry &e = contents_[key];
+
+        if (!same_owner(e.owner, owner))
+        {
+            e.owner = owner;
+            e.contents = std::move(contents);
+        }
+
+        return std::static_pointer_cast< const CONTENTS >(e.contents);
+    }
+
+    // Returns false if it is not known whether the memory |key|, kept alive
+    // by |owner|, holds any directives, and otherwise sets |plain| to
+    // whether it holds none.  An answer only holds for as long as the owner
+    // it was given for is alive, since the memory may be reused after that.
+    bool find_plain(const std::string &key,
+                    const std::shared_ptr< const void > &owner,
+                    bool &plain) const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        std::unordered_map< std::string, plain_entry >::const_iterator it =
+            plain_.find(key);
+
+        if (it == plain_.end() || !same_owner(it->second.owner, owner))
+        {
+            return false;
+        }
+
+        plain = it->second.plain;
+        return true;
+    }
+
+    void insert_plain(const std::string &key,
+                      const std::shared_ptr< const void > &owner,
+                      bool plain)
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        forget_expired(plain_, plain_limit_);
+        plain_[key] = plain_entry{owner, plain};
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        return contents_.size();
+    }
+
+    void clear()
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        contents_.clear();
+        plain_.clear();
+    }
+
+private:
+    struct contents_entry
+    {
+        std::weak_ptr< const void > owner;
+        std::shared_ptr< const void > contents;
+    };
+
+    struct plain_entry
+    {
+        std::weak_ptr< const void > owner;
+        bool plain;
+    };
+
+    // The number of entries in a map above which those whose owner is gone
+    // are first dropped.
+    static constexpr std::size_t min_limit() { return 1024; }
+
+    // Whether |a| still refers to the object |b| owns.  A weak_ptr keeps
+    // the control block of its object, so no other owner can share it.
+    static bool same_owner(const std::weak_ptr< const void > &a,
+                           const std::shared_ptr< const void > &b)
+    {
+        return !a.expired() && !a.owner_before(b) && !b.owner_before(a);
+    }
+
+    // Drops the entries of |map| whose owner is gone once it has grown to
+    // |limit|, which is then raised past what is left so that entries that
+    // are all alive are not checked again on every insertion.
+    template < typename MAP >
+    static void forget_expired(MAP &map, std::size_t &limit)
+    {
+        if (map.size() < limit)
+        {
+            return;
+        }
+
+        for (typename MAP::iterator it = map.begin(); it != map.end();)
+        {
+            it = it->second.owner.expired() ? map.erase(it) : ++it;
+        }
+
+        limit = std::max(min_limit(), 2 * map.size());
+    }
+
+    mutable std::mutex mutex_;
+    // by the type of the contents, the owner and what they are made from
+    std::unordered_map< std::string, contents_entry > contents_;
+    // whether memory holds no directives, by spec, address and size
+    std::unordered_map< std::string, plain_entry > plain_;
+    std::size_t contents_limit_;
+    std::size_t plain_limit_;
+};
+
+// Replaces each ${NAME} in |text| for which |arguments|, sorted by name,
+// has a value.  Anything else is copied as it is.
+template < typename CHAR_T, typename TRAITS >
+std::basic_string< CHAR_T, TRAITS > render_template(
+    const std::basic_string< CHAR_T, TRAITS > &text,
+    const std::vector< std::pair< std::basic_string< CHAR_T, TRAITS >,
+                                  std::basic_string< CHAR_T, TRAITS > > >
+        &arguments)
+{
+    using string_type = std::basic_string< CHAR_T, TRAITS >;
+    using argument = std::pair< string_type, string_type >;
+
+    const CHAR_T open_brace[] = {static_cast< CHAR_T >('$'),
+                                 static_cast< CHAR_T >('{')};
+    const CHAR_T close_brace = static_cast< CHAR_T >('}');
+
+    string_type rendered;
+    rendered.reserve(text.size());
+
+    typename string_type::size_type pos = 0;
+
+    while (true)
+    {
+        const typename string_type::size_type open =
+            text.find(open_brace, pos, 2);
+        const typename string_type::size_type close =
+            (open == string_type::npos) ? open
+                                        : text.find(close_brace, open + 2);
+
+        if (close == string_type::npos)
+        {
+            break;
+        }
+
+        const string_type name = text.substr(open + 2, close - open - 2);
+        typename std::vector< argument >::const_iterator it = std::lower_bound(
+            arguments.begin(),
+            arguments.end(),
+            name,
+            [](const argument &a, const string_type &n) {
+                return a.first < n;
+            });
+
+        if (it != arguments.end() && it->first == name)
+        {
+            rendered.append(text, pos, open - pos);
+            rendered += it->second;
+        }
+        else
+        {
+            rendered.append(text, pos, close + 1 - pos);
+        }
+
+        pos = close + 1;
+    }
+
+    rendered.append(text, pos, string_type::npos);
+    return rendered;
+}
+}
+
+#endif
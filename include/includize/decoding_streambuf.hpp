@@ -0,0 +1,196 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_DECODING_STREAMBUF_HPP
+#define INCLUDIZE_DECODING_STREAMBUF_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace includize
+{
+// Decodes a stream of bytes into characters a block at a time.  This class
+// reads the bytes, keeps those a derived class could not decode yet for the
+// next block and restarts the stream when it is seeked to its start; the
+// derived class only decodes.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_decoding_streambuf : public std::basic_streambuf< CHAR_T, TRAITS >
+{
+public:
+    using base_type = typename std::basic_streambuf< CHAR_T, TRAITS >;
+    using char_type = typename base_type::char_type;
+    using traits_type = typename base_type::traits_type;
+    using int_type = typename base_type::int_type;
+    using pos_type = typename base_type::pos_type;
+    using off_type = typename base_type::off_type;
+
+public:
+    basic_decoding_streambuf(basic_decoding_streambuf &) = delete;
+
+protected:
+    // Reads |bytes| through a buffer of |in_size| bytes into one of
+    // |out_size| characters, which decode() must never need more of.
+    // |read| holds the first few bytes if they were already taken from
+    // |bytes|, e.g. to detect the encoding.
+    basic_decoding_streambuf(std::unique_ptr< std::streambuf > bytes,
+                             std::size_t in_size,
+                             std::size_t out_size,
+                             const std::string &read)
+        : bytes_(std::move(bytes))
+        , started_(false)
+        , in_(std::max(in_size, read.size()))
+        , in_size_(read.size())
+        , out_(out_size)
+        , eof_(false)
+    {
+        std::memcpy(&in_[0], read.data(), read.size());
+        base_type::setg(nullptr, nullptr, nullptr);
+    }
+
+    // The number of bytes start() needs to see, unless there are fewer.
+    virtual std::size_t header_size() const { return 0; }
+
+    // Called with the first bytes before any are decoded, and returns how
+    // many of them to skip, e.g. for a byte order mark.
+    virtual std::size_t start(const unsigned char *in, std::size_t size)
+    {
+        (void)in;
+        (void)size;
+        return 0;
+    }
+
+    // Decodes up to |size| bytes of |in| into |out|, sets |produced| to the
+    // number of characters written and returns the number of bytes used.
+    // A sequence cut off at the end may be left for the next call unless
+    // the input is |final|.
+    virtual std::size_t decode(const unsigned char *in,
+                               std::size_t size,
+                               bool final,
+                               char_type *out,
+                               std::size_t &produced) = 0;
+
+    // Called when the stream starts over, to reset any decoding state.
+    virtual void restart() {}
+
+    int_type underflow() override
+    {
+        if (base_type::gptr() < base_type::egptr())
+        {
+            return traits_type::to_int_type(*base_type::gptr());
+        }
+
+        while (true)
+        {
+            if (!eof_ && in_size_ < in_.size())
+            {
+                const std::streamsize n =
+                    bytes_->sgetn(&in_[in_size_], in_.size() - in_size_);
+
+                if (n <= 0)
+                {
+                    eof_ = true;
+                }
+                else
+                {
+                    in_size_ += n;
+                }
+            }
+
+            const unsigned char *in =
+                reinterpret_cast< const unsigned char * >(in_.data());
+            std::size_t skip = 0;
+
+            if (!started_ && (in_size_ >= header_size() || eof_))
+            {
+                started_ = true;
+                skip = start(in, in_size_);
+            }
+
+            std::size_t produced = 0;
+            const std::size_t consumed =
+                started_ ? decode(in + skip,
+                                  in_size_ - skip,
+                                  eof_,
+                                  out_.data(),
+                                  produced)
+                         : 0;
+
+            in_size_ -= skip + consumed;
+            std::memmove(&in_[0], &in_[skip + consumed], in_size_);
+
+            if (produced)
+            {
+                base_type::setg(
+                    out_.data(), out_.data(), out_.data() + produced);
+                return traits_type::to_int_type(*base_type::gptr());
+            }
+
+            // nothing more will come of what is left, such as bytes that
+            // cannot be decoded filling the whole buffer
+            if (eof_ || (started_ && !consumed && in_size_ == in_.size()))
+            {
+                return traits_type::eof();
+            }
+        }
+    }
+
+    // Positions cannot be told, but the stream can always be restarted.
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        if (off_type(pos) != 0 || !(which & std::ios_base::in) ||
+            bytes_->pubseekpos(0, std::ios_base::in) != pos_type(0))
+        {
+            return pos_type(off_type(-1));
+        }
+
+        restart();
+        started_ = false;
+        in_size_ = 0;
+        eof_ = false;
+        base_type::setg(nullptr, nullptr, nullptr);
+        return pos;
+    }
+
+private:
+    std::unique_ptr< std::streambuf > bytes_;
+    bool started_;
+    std::vector< char > in_;
+    std::size_t in_size_;
+    std::vector< char_type > out_;
+    bool eof_;
+};
+}
+
+#endif
@@ -0,0 +1,428 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_DECOMPRESS_HPP
+#define INCLUDIZE_DECOMPRESS_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <ios>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef INCLUDIZE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef INCLUDIZE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "resolver.hpp"
+
+// Included files compressed with gzip or zstd are decompressed as they are
+// read.  Support for each format is compiled in when INCLUDIZE_HAVE_ZLIB or
+// INCLUDIZE_HAVE_ZSTD is defined, in which case the program must also be
+// linked with -lz or -lzstd.
+
+namespace includize
+{
+#ifdef INCLUDIZE_HAVE_ZLIB
+// Inflates a gzip (or zlib) stream, including concatenated gzip members.
+// A stream that is corrupt or ends in the middle of a member throws
+// std::ios_base::failure, which sets badbit on the istream reading it.
+class gzip_streambuf : public std::streambuf
+{
+public:
+    explicit gzip_streambuf(std::unique_ptr< std::streambuf > compressed)
+        : compressed_(std::move(compressed))
+        , in_(block_size())
+        , out_(block_size())
+        , in_member_(false)
+    {
+        std::memset(&stream_, 0, sizeof(stream_));
+        good_ = (inflateInit2(&stream_, 15 + 32) == Z_OK);
+        initialized_ = good_;
+        setg(nullptr, nullptr, nullptr);
+    }
+
+    gzip_streambuf(gzip_streambuf &) = delete;
+
+    ~gzip_streambuf()
+    {
+        if (initialized_)
+        {
+            inflateEnd(&stream_);
+        }
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr())
+        {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        while (good_)
+        {
+            if (stream_.avail_in == 0)
+            {
+                const std::streamsize n =
+                    compressed_->sgetn(in_.data(), in_.size());
+
+                if (n <= 0)
+                {
+                    if (in_member_)
+                    {
+                        fail("truncated gzip stream");
+                    }
+
+                    break;
+                }
+
+                stream_.next_in = reinterpret_cast< Bytef * >(in_.data());
+                stream_.avail_in = static_cast< uInt >(n);
+            }
+
+            stream_.next_out = reinterpret_cast< Bytef * >(out_.data());
+            stream_.avail_out = static_cast< uInt >(out_.size());
+            in_member_ = true;
+
+            const int r = inflate(&stream_, Z_NO_FLUSH);
+
+            if (r == Z_STREAM_END)
+            {
+                inflateReset(&stream_);
+                in_member_ = false;
+            }
+            else if (r != Z_OK && r != Z_BUF_ERROR)
+            {
+                fail("corrupt gzip stream");
+            }
+
+            const std::size_t produced = out_.size() - stream_.avail_out;
+
+            if (produced)
+            {
+                setg(out_.data(), out_.data(), out_.data() + produced);
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+
+        return traits_type::eof();
+    }
+
+    // The stream can only be restarted, not positioned.
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        if (off_type(pos) != 0 || !(which & std::ios_base::in) ||
+            !initialized_ ||
+            compressed_->pubseekpos(0, std::ios_base::in) != pos_type(0))
+        {
+            return pos_type(off_type(-1));
+        }
+
+        inflateReset(&stream_);
+        stream_.avail_in = 0;
+        good_ = true;
+        in_member_ = false;
+        setg(nullptr, nullptr, nullptr);
+        return pos;
+    }
+
+private:
+    static constexpr std::size_t block_size() { return 65536; }
+
+    void fail(const char *what)
+    {
+        good_ = false;
+        setg(nullptr, nullptr, nullptr);
+        throw std::ios_base::failure(std::string("includize: ") + what);
+    }
+
+    std::unique_ptr< std::streambuf > compressed_;
+    std::vector< char > in_;
+    std::vector< char > out_;
+    z_stream stream_;
+    bool initialized_;
+    bool good_;
+    // whether a member has been started but not finished
+    bool in_member_;
+};
+#endif
+
+#ifdef INCLUDIZE_HAVE_ZSTD
+// Decompresses a zstd stream, including concatenated frames.  A stream that
+// is corrupt or ends in the middle of a frame throws std::ios_base::failure,
+// which sets badbit on the istream reading it.
+class zstd_streambuf : public std::streambuf
+{
+public:
+    explicit zstd_streambuf(std::unique_ptr< std::streambuf > compressed)
+        : compressed_(std::move(compressed))
+        , stream_(ZSTD_createDStream())
+        , in_(ZSTD_DStreamInSize())
+        , out_(ZSTD_DStreamOutSize())
+        , good_(stream_ && !ZSTD_isError(ZSTD_initDStream(stream_)))
+        , in_frame_(false)
+    {
+        input_.src = in_.data();
+        input_.size = 0;
+        input_.pos = 0;
+        setg(nullptr, nullptr, nullptr);
+    }
+
+    zstd_streambuf(zstd_streambuf &) = delete;
+
+    ~zstd_streambuf()
+    {
+        if (stream_)
+        {
+            ZSTD_freeDStream(stream_);
+        }
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr())
+        {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        while (good_)
+        {
+            bool end = false;
+
+            if (input_.pos == input_.size)
+            {
+                const std::streamsize n =
+                    compressed_->sgetn(in_.data(), in_.size());
+
+                if (n <= 0 && !in_frame_)
+                {
+                    break;
+                }
+
+                // a frame that is started may still have output to flush
+                end = (n <= 0);
+                input_.size = std::max< std::streamsize >(n, 0);
+                input_.pos = 0;
+            }
+
+            ZSTD_outBuffer output = {out_.data(), out_.size(), 0};
+            const std::size_t r =
+                ZSTD_decompressStream(stream_, &output, &input_);
+
+            if (ZSTD_isError(r))
+            {
+                fail("corrupt zstd stream");
+            }
+
+            in_frame_ = (r != 0);
+
+            if (output.pos)
+            {
+                setg(out_.data(), out_.data(), out_.data() + output.pos);
+                return traits_type::to_int_type(*gptr());
+            }
+
+            if (end && in_frame_)
+            {
+                fail("truncated zstd stream");
+            }
+        }
+
+        return traits_type::eof();
+    }
+
+    // The stream can only be restarted, not positioned.
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        if (off_type(pos) != 0 || !(which & std::ios_base::in) || !stream_ ||
+            compressed_->pubseekpos(0, std::ios_base::in) != pos_type(0))
+        {
+            return pos_type(off_type(-1));
+        }
+
+        good_ = !ZSTD_isError(ZSTD_initDStream(stream_));
+        in_frame_ = false;
+        input_.size = 0;
+        input_.pos = 0;
+        setg(nullptr, nullptr, nullptr);
+        return pos;
+    }
+
+private:
+    void fail(const char *what)
+    {
+        good_ = false;
+        setg(nullptr, nullptr, nullptr);
+        throw std::ios_base::failure(std::string("includize: ") + what);
+    }
+
+    std::unique_ptr< std::streambuf > compressed_;
+    ZSTD_DStream *stream_;
+    std::vector< char > in_;
+    std::vector< char > out_;
+    ZSTD_inBuffer input_;
+    bool good_;
+    // whether a frame has been started but not finished
+    bool in_frame_;
+};
+#endif
+
+// Wraps another resolver and transparently decompresses the files it opens
+// that are compressed, recognized by a .gz or .zst extension or else by the
+// magic bytes at their start.  Compressed files in a format that was not
+// compiled in cannot be opened.
+class decompressing_resolver : public resolver
+{
+public:
+    explicit decompressing_resolver(std::shared_ptr< resolver > r =
+                                    std::make_shared< filesystem_resolver >())
+        : resolver_(r)
+    {
+    }
+
+    std::unique_ptr< std::streambuf > open(const std::string &name) override
+    {
+        return decompress(resolver_->open(name), name);
+    }
+
+    std::unique_ptr< std::streambuf > open(const directory &dir,
+                                           const std::string &name) override
+    {
+        return decompress(resolver_->open(dir, name), name);
+    }
+
+    std::vector< std::string > list(const std::string &path) override
+    {
+        return resolver_->list(path);
+    }
+
+    std::vector< std::string > list(const directory &dir,
+                                    const std::string &path) override
+    {
+        return resolver_->list(dir, path);
+    }
+
+private:
+    enum class format
+    {
+        plain,
+        gzip,
+        zstd
+    };
+
+    static std::unique_ptr< std::streambuf > decompress(
+        std::unique_ptr< std::streambuf > bytes, const std::string &name)
+    {
+        if (!bytes)
+        {
+            return bytes;
+        }
+
+        switch (detect(*bytes, name))
+        {
+            case format::gzip:
+#ifdef INCLUDIZE_HAVE_ZLIB
+                return std::unique_ptr< std::streambuf >(
+                    new gzip_streambuf(std::move(bytes)));
+#else
+                return nullptr;
+#endif
+            case format::zstd:
+#ifdef INCLUDIZE_HAVE_ZSTD
+                return std::unique_ptr< std::streambuf >(
+                    new zstd_streambuf(std::move(bytes)));
+#else
+                return nullptr;
+#endif
+            default:
+                return bytes;
+        }
+    }
+
+    static format detect(std::streambuf &bytes, const std::string &name)
+    {
+        if (ends_with(name, ".gz"))
+        {
+            return format::gzip;
+        }
+
+        if (ends_with(name, ".zst"))
+        {
+            return format::zstd;
+        }
+
+        const std::streambuf::pos_type start =
+            bytes.pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+
+        if (start == std::streambuf::pos_type(std::streambuf::off_type(-1)))
+        {
+            return format::plain;
+        }
+
+        unsigned char magic[4] = {0, 0, 0, 0};
+        bytes.sgetn(reinterpret_cast< char * >(magic), sizeof(magic));
+        bytes.pubseekpos(start, std::ios_base::in);
+
+        if (magic[0] == 0x1f && magic[1] == 0x8b)
+        {
+            return format::gzip;
+        }
+
+        if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+            magic[3] == 0xfd)
+        {
+            return format::zstd;
+        }
+
+        return format::plain;
+    }
+
+    static bool ends_with(const std::string &name, const std::string &suffix)
+    {
+        return name.size() >= suffix.size() &&
+               name.compare(
+                   name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    std::shared_ptr< resolver > resolver_;
+};
+}
+
+#endif
@@ -0,0 +1,184 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_DIRECTORY_HPP
+#define INCLUDIZE_DIRECTORY_HPP
+
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+
+namespace includize
+{
+// A directory that files are included from.  It holds a descriptor for the
+// directory when it exists on the filesystem, so files in it can be opened
+// with openat() regardless of the working directory.  Directories opened
+// by path get their descriptor right away, so later changes of the working
+// directory do not affect them.  Subdirectories and paths as strings are
+// only made when something asks for them.  A directory may be used from
+// several threads at once.
+class directory : public std::enable_shared_from_this< directory >
+{
+public:
+    // Opens |path|, which is relative to the working directory unless it is
+    // absolute.  The empty path is the working directory.
+    static std::shared_ptr< const directory > open(const std::string &path)
+    {
+        std::string name = path;
+
+        if (name.size() && !(*name.rbegin() == '/'))
+        {
+            name += "/";
+        }
+
+        std::shared_ptr< directory > dir(new directory(nullptr, name));
+        dir->fd_ = open_fd(AT_FDCWD, name.empty() ? "." : name);
+        dir->fd_opened_ = true;
+        return dir;
+    }
+
+    directory(directory &) = delete;
+
+    ~directory()
+    {
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+    }
+
+    // The descriptor of the directory, or -1 if it could not be opened, e.g.
+    // because it only exists for a resolver that does not use the
+    // filesystem.  Subdirectories are opened relative to their parent.
+    int fd() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+
+        if (!fd_opened_)
+        {
+            if (parent_->fd() >= 0)
+            {
+                fd_ = open_fd(parent_->fd(), name_);
+            }
+
+            fd_opened_ = true;
+        }
+
+        return fd_;
+    }
+
+    // The path of the directory with a trailing '/', or "" for the working
+    // directory.
+    const std::string &path() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+
+        if (!path_built_)
+        {
+            path_ = parent_ ? parent_->path() + name_ : name_;
+            path_built_ = true;
+        }
+
+        return path_;
+    }
+
+    // Returns the directory that |name|, a path relative to this directory
+    // or an absolute one, refers to.  The same object is returned for as
+    // long as it is in use.
+    std::shared_ptr< const directory > subdirectory(
+        const std::string &name) const
+    {
+        if (name.empty())
+        {
+            return shared_from_this();
+        }
+
+        if (name[0] == '/')
+        {
+            return open(name);
+        }
+
+        std::lock_guard< std::mutex > lock(mutex_);
+        std::weak_ptr< const directory > &cached = subdirectories_[name];
+        std::shared_ptr< const directory > sub = cached.lock();
+
+        if (!sub)
+        {
+            std::string component = name;
+
+            if (!(*component.rbegin() == '/'))
+            {
+                component += "/";
+            }
+
+            sub.reset(new directory(shared_from_this(), component));
+            cached = sub;
+        }
+
+        return sub;
+    }
+
+private:
+    directory(std::shared_ptr< const directory > parent,
+              const std::string &name)
+        : parent_(parent)
+        , name_(name)
+        , fd_(-1)
+        , fd_opened_(false)
+        , path_built_(false)
+    {
+    }
+
+    static int open_fd(int at, const std::string &name)
+    {
+#ifdef O_PATH
+        const int flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+#else
+        const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+#endif
+        return ::openat(at, name.c_str(), flags);
+    }
+
+    std::shared_ptr< const directory > parent_;
+    std::string name_;
+    mutable std::mutex mutex_;
+    mutable int fd_;
+    mutable bool fd_opened_;
+    mutable bool path_built_;
+    mutable std::string path_;
+    mutable std::map< std::string, std::weak_ptr< const directory > >
+        subdirectories_;
+};
+}
+
+#endif
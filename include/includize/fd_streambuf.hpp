@@ -0,0 +1,180 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_FD_STREAMBUF_HPP
+#define INCLUDIZE_FD_STREAMBUF_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <streambuf>
+#include <unistd.h>
+#include <vector>
+
+namespace includize
+{
+// Reads the bytes of an open file descriptor, which it takes ownership of.
+// Large reads go straight into the caller's buffer and the position is
+// tracked without asking the kernel.
+class fd_streambuf : public std::streambuf
+{
+public:
+    explicit fd_streambuf(int fd) : fd_(fd), offset_(0), buffer_(block_size())
+    {
+        setg(nullptr, nullptr, nullptr);
+    }
+
+    fd_streambuf(fd_streambuf &) = delete;
+
+    ~fd_streambuf()
+    {
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr())
+        {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        const std::streamsize n = read(buffer_.data(), buffer_.size());
+
+        if (n <= 0)
+        {
+            setg(nullptr, nullptr, nullptr);
+            return traits_type::eof();
+        }
+
+        setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize xsgetn(char_type *s, std::streamsize n) override
+    {
+        std::streamsize copied =
+            std::min< std::streamsize >(n, egptr() - gptr());
+
+        if (copied > 0)
+        {
+            std::memcpy(s, gptr(), copied);
+            gbump(static_cast< int >(copied));
+        }
+
+        if (copied < n && n - copied >= static_cast< std::streamsize >(
+                                              buffer_.size()))
+        {
+            const std::streamsize r = read(s + copied, n - copied);
+            copied += std::max< std::streamsize >(r, 0);
+
+            // the buffer no longer ends at offset_, so it cannot serve seeks
+            setg(nullptr, nullptr, nullptr);
+        }
+        else if (copied < n)
+        {
+            copied += std::streambuf::xsgetn(s + copied, n - copied);
+        }
+
+        return copied;
+    }
+
+    pos_type seekoff(off_type off,
+                     std::ios_base::seekdir dir,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        if (dir == std::ios_base::cur)
+        {
+            if (off == 0)
+            {
+                return pos_type(offset_ - (egptr() - gptr()));
+            }
+
+            off += offset_ - (egptr() - gptr());
+            dir = std::ios_base::beg;
+        }
+
+        // stay within what has already been read if we can
+        if (dir == std::ios_base::beg && (which & std::ios_base::in) &&
+            off >= offset_ - (egptr() - eback()) && off <= offset_)
+        {
+            setg(eback(), egptr() - (offset_ - off), egptr());
+            return pos_type(off);
+        }
+
+        const off_type r = ::lseek(
+            fd_, off, (dir == std::ios_base::beg) ? SEEK_SET : SEEK_END);
+
+        if (!(which & std::ios_base::in) || r < 0)
+        {
+            return pos_type(off_type(-1));
+        }
+
+        offset_ = r;
+        setg(nullptr, nullptr, nullptr);
+        return pos_type(r);
+    }
+
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+
+private:
+    static constexpr std::size_t block_size() { return 8192; }
+
+    std::streamsize read(char_type *s, std::size_t n)
+    {
+        ssize_t r;
+
+        do
+        {
+            r = ::read(fd_, s, n);
+        } while (r < 0 && errno == EINTR);
+
+        if (r > 0)
+        {
+            offset_ += r;
+        }
+
+        return r;
+    }
+
+    int fd_;
+    off_type offset_;
+    std::vector< char_type > buffer_;
+};
+}
+
+#endif
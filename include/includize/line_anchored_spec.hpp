@@ -0,0 +1,61 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_LINE_ANCHORED_SPEC_HPP
+#define INCLUDIZE_LINE_ANCHORED_SPEC_HPP
+
+#include "spec_traits.hpp"
+
+// line_anchored_spec only recognizes the directives of a spec at the start of
+// a line, after spaces and tabs:
+//
+//     using spec =
+//         includize::line_anchored_spec< includize::toml_spec< char > >;
+//     includize::basic_preprocessor< spec, char > pp("base.toml");
+//
+// Header starts anywhere else, like the brackets of TOML arrays or the hash
+// of a trailing comment, are then passed over without trying the regex.
+
+namespace includize
+{
+template < typename SPEC >
+struct line_anchored_spec
+{
+};
+
+template < typename SPEC >
+struct include_spec_traits< line_anchored_spec< SPEC > >
+    : include_spec_traits< SPEC >
+{
+    static constexpr bool line_anchored() { return true; }
+};
+}
+
+#endif
@@ -0,0 +1,120 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_MEMORY_STREAMBUF_HPP
+#define INCLUDIZE_MEMORY_STREAMBUF_HPP
+
+#include <cstddef>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+namespace includize
+{
+// A read-only stream buffer over characters that are already in memory.  The
+// characters are not copied, so they must outlive the stream buffer unless
+// |owner| keeps them alive.  basic_streambuf recognizes this type and scans
+// the characters in place.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_memory_streambuf : public std::basic_streambuf< CHAR_T, TRAITS >
+{
+public:
+    using base_type = typename std::basic_streambuf< CHAR_T, TRAITS >;
+    using char_type = typename base_type::char_type;
+    using traits_type = typename base_type::traits_type;
+    using int_type = typename base_type::int_type;
+    using pos_type = typename base_type::pos_type;
+    using off_type = typename base_type::off_type;
+
+public:
+    basic_memory_streambuf(const char_type *data,
+                           std::size_t size,
+                           std::shared_ptr< const void > owner = nullptr)
+        : owner_(std::move(owner))
+    {
+        char_type *begin = const_cast< char_type * >(data);
+        base_type::setg(begin, begin, begin + size);
+    }
+
+    basic_memory_streambuf(basic_memory_streambuf &) = delete;
+
+    const char_type *data() const { return base_type::eback(); }
+
+    std::size_t size() const { return base_type::egptr() - base_type::eback(); }
+
+    // What keeps the characters alive, if anything.
+    const std::shared_ptr< const void > &owner() const { return owner_; }
+
+protected:
+    pos_type seekoff(off_type off,
+                     std::ios_base::seekdir dir,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        off_type base = 0;
+
+        if (dir == std::ios_base::cur)
+        {
+            base = base_type::gptr() - base_type::eback();
+        }
+        else if (dir == std::ios_base::end)
+        {
+            base = size();
+        }
+
+        return seekpos(pos_type(base + off), which);
+    }
+
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        const off_type off = off_type(pos);
+
+        if (!(which & std::ios_base::in) || off < 0 ||
+            off > static_cast< off_type >(size()))
+        {
+            return pos_type(off_type(-1));
+        }
+
+        base_type::setg(
+            base_type::eback(), base_type::eback() + off, base_type::egptr());
+        return pos;
+    }
+
+    // only called once the get area, and so the whole buffer, is exhausted
+    std::streamsize showmanyc() override { return -1; }
+
+private:
+    std::shared_ptr< const void > owner_;
+};
+
+using memory_streambuf = basic_memory_streambuf< char >;
+}
+
+#endif
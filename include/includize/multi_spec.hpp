@@ -0,0 +1,160 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_MULTI_SPEC_HPP
+#define INCLUDIZE_MULTI_SPEC_HPP
+
+#include <string>
+
+#include "char_set.hpp"
+#include "spec_traits.hpp"
+
+// multi_spec combines several include specifications into one, so a file can
+// use the directives of all of them and still be expanded in a single pass:
+//
+//     using spec = includize::multi_spec< includize::toml_spec< char >,
+//                                         includize::universal_spec< char > >;
+//     includize::basic_preprocessor< spec, char > pp("base.toml");
+//
+// A line is read by the first spec, in the order given, whose header start
+// it begins with and whose directive it holds.
+
+namespace includize
+{
+template < typename... SPECS >
+struct multi_spec
+{
+};
+
+template < typename FIRST, typename... REST >
+struct include_spec_traits< multi_spec< FIRST, REST... > >
+{
+    using char_type = typename include_spec_traits< FIRST >::char_type;
+    using traits_type = std::char_traits< char_type >;
+    using directive_type = include_directive< char_type >;
+
+    // only if every spec is
+    static constexpr bool line_anchored()
+    {
+        return all_anchored< FIRST, REST... >();
+    }
+
+    static std::basic_string< char_type > header_starts()
+    {
+        return concat< FIRST, REST... >();
+    }
+
+    static const char_type *find_header_start(const char_type *begin,
+                                              const char_type *end)
+    {
+        static const char_set< char_type > set(header_starts());
+        return set.find(begin, end);
+    }
+
+    static bool may_hold_directive(const char_type *begin,
+                                   const char_type *end)
+    {
+        return may_hold_any< FIRST, REST... >(begin, end);
+    }
+
+    template < typename CONDITION >
+    static bool match(const char_type *begin,
+                      const char_type *end,
+                      directive_type &directive,
+                      const CONDITION &holds)
+    {
+        return match_any< FIRST, REST... >(begin, end, directive, holds);
+    }
+
+private:
+    template < typename S >
+    static constexpr bool all_anchored()
+    {
+        return include_spec_traits< S >::line_anchored();
+    }
+
+    template < typename S, typename NEXT, typename... MORE >
+    static constexpr bool all_anchored()
+    {
+        return include_spec_traits< S >::line_anchored() &&
+               all_anchored< NEXT, MORE... >();
+    }
+
+    template < typename S >
+    static bool may_hold_any(const char_type *begin, const char_type *end)
+    {
+        return include_spec_traits< S >::may_hold_directive(begin, end);
+    }
+
+    template < typename S, typename NEXT, typename... MORE >
+    static bool may_hold_any(const char_type *begin, const char_type *end)
+    {
+        return include_spec_traits< S >::may_hold_directive(begin, end) ||
+               may_hold_any< NEXT, MORE... >(begin, end);
+    }
+
+    template < typename S >
+    static std::basic_string< char_type > concat()
+    {
+        return include_spec_traits< S >::header_starts();
+    }
+
+    template < typename S, typename NEXT, typename... MORE >
+    static std::basic_string< char_type > concat()
+    {
+        return include_spec_traits< S >::header_starts() +
+               concat< NEXT, MORE... >();
+    }
+
+    template < typename S, typename CONDITION >
+    static bool match_any(const char_type *begin,
+                          const char_type *end,
+                          directive_type &directive,
+                          const CONDITION &holds)
+    {
+        return include_spec_traits< S >::match(begin, end, directive, holds);
+    }
+
+    template < typename S,
+               typename NEXT,
+               typename... MORE,
+               typename CONDITION >
+    static bool match_any(const char_type *begin,
+                          const char_type *end,
+                          directive_type &directive,
+                          const CONDITION &holds)
+    {
+        return include_spec_traits< S >::match(begin, end, directive, holds) ||
+               match_any< NEXT, MORE... >(begin, end, directive, holds);
+    }
+};
+}
+
+#endif
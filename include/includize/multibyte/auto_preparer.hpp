@@ -0,0 +1,132 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_AUTO_PREPARER_HPP
+#define INCLUDIZE_AUTO_PREPARER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+#include "../memory_streambuf.hpp"
+#include "utf16_streambuf.hpp"
+#include "utf8_streambuf.hpp"
+
+namespace includize
+{
+enum class text_encoding
+{
+    utf8,
+    utf16_big_endian,
+    utf16_little_endian
+};
+
+// Guesses the encoding of a file from its first |size| bytes at |data|: a
+// byte order mark decides it, and otherwise a zero byte next to a non-zero
+// one at the start gives away UTF-16 text starting with ASCII, as it does
+// for most configuration files.  Anything else is taken to be UTF-8.  |bom|
+// is set to whether a UTF-16 byte order mark was found.
+inline text_encoding detect_encoding(const char *data,
+                                     std::size_t size,
+                                     bool &bom)
+{
+    const unsigned char *b = reinterpret_cast< const unsigned char * >(data);
+
+    bom = size >= 2 && ((b[0] == 0xfe && b[1] == 0xff) ||
+                        (b[0] == 0xff && b[1] == 0xfe));
+
+    if (bom)
+    {
+        return (b[0] == 0xfe) ? text_encoding::utf16_big_endian
+                              : text_encoding::utf16_little_endian;
+    }
+
+    if (size >= 2 && !b[0] && b[1])
+    {
+        return text_encoding::utf16_big_endian;
+    }
+
+    if (size >= 2 && b[0] && !b[1])
+    {
+        return text_encoding::utf16_little_endian;
+    }
+
+    return text_encoding::utf8;
+}
+
+// Reads every file, whether the root or an included one, in the encoding
+// detect_encoding() finds for it, into char16_t, char32_t or wchar_t.  A
+// byte order mark is skipped.  Files in memory are looked at in place, and
+// the bytes taken from any other file to detect its encoding are handed to
+// its decoder, so no file is read twice.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+struct auto_stream_preparer
+{
+    static std::unique_ptr< std::basic_streambuf< CHAR_T, TRAITS > >
+    prepare_streambuf(std::unique_ptr< std::streambuf > bytes)
+    {
+        std::string read;
+        text_encoding encoding;
+        bool bom;
+
+        if (const memory_streambuf *memory =
+                dynamic_cast< const memory_streambuf * >(bytes.get()))
+        {
+            encoding = detect_encoding(memory->data(), memory->size(), bom);
+        }
+        else
+        {
+            char sniffed[2];
+            const std::streamsize n = bytes->sgetn(sniffed, sizeof(sniffed));
+            read.assign(sniffed, (n > 0) ? n : 0);
+            encoding = detect_encoding(read.data(), read.size(), bom);
+        }
+
+        if (encoding == text_encoding::utf8)
+        {
+            return std::unique_ptr< std::basic_streambuf< CHAR_T, TRAITS > >(
+                new basic_utf8_streambuf< CHAR_T, TRAITS >(std::move(bytes),
+                                                           read));
+        }
+
+        const utf16_byte_order order =
+            (encoding == text_encoding::utf16_little_endian)
+                ? utf16_byte_order::little_endian
+                : utf16_byte_order::big_endian;
+
+        // the decoder skips a byte order mark only when it detects the order
+        return prepare_utf16_streambuf< CHAR_T, TRAITS >(
+            std::move(bytes), bom ? utf16_byte_order::detect : order, read);
+    }
+};
+}
+
+#endif
@@ -0,0 +1,351 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_UTF16_STREAMBUF_HPP
+#define INCLUDIZE_UTF16_STREAMBUF_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../decoding_streambuf.hpp"
+#include "../memory_streambuf.hpp"
+
+namespace includize
+{
+enum class utf16_byte_order
+{
+    // from the byte order mark, which is skipped, or big endian without one
+    detect,
+    big_endian,
+    little_endian
+};
+
+// Returns how many of the first |units| UTF-16 code units at |in| are
+// known to hold no surrogates, i.e. to stand for themselves.  The units are
+// big endian if |big_endian| is set and little endian otherwise.  Where
+// SSE2 is available runs are checked 8 code units at a time, otherwise
+// nothing is known and 0 is returned.
+inline std::size_t utf16_plain_units(const unsigned char *in,
+                                     std::size_t units,
+                                     bool big_endian)
+{
+    std::size_t done = 0;
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi16(static_cast< short >(0xf800));
+    const __m128i surrogate = _mm_set1_epi16(static_cast< short >(0xd800));
+
+    for (; done + 8 <= units; done += 8)
+    {
+        __m128i v = _mm_loadu_si128(
+            reinterpret_cast< const __m128i * >(in + 2 * done));
+
+        if (big_endian)
+        {
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        }
+
+        if (_mm_movemask_epi8(
+                _mm_cmpeq_epi16(_mm_and_si128(v, mask), surrogate)))
+        {
+            break;
+        }
+    }
+#else
+    (void)in;
+    (void)units;
+    (void)big_endian;
+#endif
+    return done;
+}
+
+// Decodes UTF-16 bytes into characters a block at a time.  Characters of
+// four bytes receive code points and characters of two bytes code units,
+// with unpaired surrogates replaced by U+FFFD.  Runs without surrogates are
+// found with utf16_plain_units() and copied without checking each unit.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_utf16_streambuf : public basic_decoding_streambuf< CHAR_T, TRAITS >
+{
+public:
+    using decoding_type = basic_decoding_streambuf< CHAR_T, TRAITS >;
+    using char_type = typename decoding_type::char_type;
+
+public:
+    basic_utf16_streambuf(std::unique_ptr< std::streambuf > bytes,
+                          utf16_byte_order order,
+                          const std::string &read = std::string())
+        : decoding_type(std::move(bytes), 2 * block_size(), block_size(), read)
+        , order_(order)
+        , big_endian_(order != utf16_byte_order::little_endian)
+    {
+    }
+
+protected:
+    std::size_t header_size() const override { return 2; }
+
+    // Takes the byte order from the byte order mark, if it is to be
+    // detected, and skips the mark.
+    std::size_t start(const unsigned char *in, std::size_t size) override
+    {
+        if (order_ != utf16_byte_order::detect || size < 2)
+        {
+            return 0;
+        }
+
+        if (in[0] == 0xfe && in[1] == 0xff)
+        {
+            big_endian_ = true;
+            return 2;
+        }
+
+        if (in[0] == 0xff && in[1] == 0xfe)
+        {
+            big_endian_ = false;
+            return 2;
+        }
+
+        return 0;
+    }
+
+    // Every two bytes make at most one character, so the output buffer is
+    // half as big as the input buffer.  A high surrogate at the end is left
+    // for the next call unless the input is |final|.
+    std::size_t decode(const unsigned char *in,
+                       std::size_t size,
+                       bool final,
+                       char_type *out,
+                       std::size_t &produced) override
+    {
+        const std::size_t units = size / 2;
+        std::size_t i = 0;
+        char_type *o = out;
+
+        while (i < units)
+        {
+            const std::size_t end =
+                i + utf16_plain_units(in + 2 * i, units - i, big_endian_);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            if (sizeof(char_type) == 2 && !big_endian_)
+            {
+                std::memcpy(o, in + 2 * i, 2 * (end - i));
+                o += end - i;
+                i = end;
+            }
+#endif
+            for (; i < end; ++i)
+            {
+                *o++ = static_cast< char_type >(unit(in, i));
+            }
+
+            if (i == units)
+            {
+                break;
+            }
+
+            const unsigned u = unit(in, i);
+
+            if (u < 0xd800 || u > 0xdfff)
+            {
+                *o++ = static_cast< char_type >(u);
+                ++i;
+            }
+            else if (u <= 0xdbff && i + 1 < units)
+            {
+                const unsigned low = unit(in, i + 1);
+
+                if (low >= 0xdc00 && low <= 0xdfff && sizeof(char_type) == 2)
+                {
+                    *o++ = static_cast< char_type >(u);
+                    *o++ = static_cast< char_type >(low);
+                    i += 2;
+                }
+                else if (low >= 0xdc00 && low <= 0xdfff)
+                {
+                    *o++ = static_cast< char_type >(
+                        0x10000 + ((u - 0xd800) << 10) + (low - 0xdc00));
+                    i += 2;
+                }
+                else
+                {
+                    *o++ = static_cast< char_type >(0xfffd);
+                    ++i;
+                }
+            }
+            else if (u <= 0xdbff && !final)
+            {
+                break;
+            }
+            else
+            {
+                *o++ = static_cast< char_type >(0xfffd);
+                ++i;
+            }
+        }
+
+        produced = o - out;
+        return 2 * i;
+    }
+
+    void restart() override
+    {
+        big_endian_ = (order_ != utf16_byte_order::little_endian);
+    }
+
+private:
+    static constexpr std::size_t block_size() { return 8192; }
+
+    unsigned unit(const unsigned char *in, std::size_t i) const
+    {
+        return big_endian_ ? (unsigned(in[2 * i]) << 8 | in[2 * i + 1])
+                           : (unsigned(in[2 * i + 1]) << 8 | in[2 * i]);
+    }
+
+    utf16_byte_order order_;
+    bool big_endian_;
+};
+
+// Whether the code units [begin, end) pair every surrogate.
+template < typename CHAR_T >
+bool utf16_valid(const CHAR_T *begin, const CHAR_T *end)
+{
+    const CHAR_T *p = begin;
+
+    while (p < end)
+    {
+        // the code units are in the byte order of the host, where SSE2 is
+        // little endian
+        p += utf16_plain_units(
+            reinterpret_cast< const unsigned char * >(p), end - p, false);
+
+        if (p == end)
+        {
+            break;
+        }
+
+        const unsigned u = static_cast< std::uint16_t >(*p++);
+
+        if (u < 0xd800 || u > 0xdfff)
+        {
+            continue;
+        }
+
+        if (u > 0xdbff || p == end ||
+            static_cast< std::uint16_t >(*p) < 0xdc00 ||
+            static_cast< std::uint16_t >(*p) > 0xdfff)
+        {
+            return false;
+        }
+
+        ++p;
+    }
+
+    return true;
+}
+
+// Turns UTF-16 |bytes|, of which |read| were already taken, into
+// characters.  Where the bytes are already in memory, e.g. in a bundle, and
+// are little endian with valid surrogates, characters of two bytes on a
+// little endian host are served straight from that memory.  Everything else
+// is decoded by a basic_utf16_streambuf.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+std::unique_ptr< std::basic_streambuf< CHAR_T, TRAITS > >
+prepare_utf16_streambuf(std::unique_ptr< std::streambuf > bytes,
+                        utf16_byte_order order,
+                        const std::string &read = std::string())
+{
+    using streambuf_type = std::basic_streambuf< CHAR_T, TRAITS >;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const memory_streambuf *memory =
+        dynamic_cast< const memory_streambuf * >(bytes.get());
+
+    if (sizeof(CHAR_T) == 2 && memory && read.empty())
+    {
+        const char *data = memory->data();
+        std::size_t size = memory->size();
+        bool little_endian = (order == utf16_byte_order::little_endian);
+
+        if (order == utf16_byte_order::detect && size >= 2)
+        {
+            const unsigned char b0 = data[0];
+            const unsigned char b1 = data[1];
+
+            if (b0 == 0xff && b1 == 0xfe)
+            {
+                little_endian = true;
+                data += 2;
+                size -= 2;
+            }
+        }
+
+        const CHAR_T *begin = reinterpret_cast< const CHAR_T * >(data);
+        const CHAR_T *end = begin + size / 2;
+
+        if (little_endian && size % 2 == 0 &&
+            reinterpret_cast< std::uintptr_t >(data) % alignof(CHAR_T) == 0 &&
+            utf16_valid(begin, end))
+        {
+            // the bytes are only a view of the memory of their owner
+            return std::unique_ptr< streambuf_type >(
+                new basic_memory_streambuf< CHAR_T, TRAITS >(
+                    begin, end - begin, memory->owner()));
+        }
+    }
+#endif
+
+    return std::unique_ptr< streambuf_type >(
+        new basic_utf16_streambuf< CHAR_T, TRAITS >(
+            std::move(bytes), order, read));
+}
+
+// Reads UTF-16 files in the byte order ORDER into characters of two or four
+// bytes, e.g. char16_t.
+template < typename CHAR_T,
+           utf16_byte_order ORDER = utf16_byte_order::detect,
+           typename TRAITS = std::char_traits< CHAR_T > >
+struct utf16_stream_preparer
+{
+    static std::unique_ptr< std::basic_streambuf< CHAR_T, TRAITS > >
+    prepare_streambuf(std::unique_ptr< std::streambuf > bytes)
+    {
+        return prepare_utf16_streambuf< CHAR_T, TRAITS >(std::move(bytes),
+                                                          ORDER);
+    }
+};
+}
+
+#endif
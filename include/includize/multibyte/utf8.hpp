@@ -0,0 +1,223 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_UTF8_HPP
+#define INCLUDIZE_UTF8_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace includize
+{
+// Appends the UTF-8 encoding of the code point |cp| to |out|.
+inline void utf8_append(std::string &out, char32_t cp)
+{
+    if (cp < 0x80)
+    {
+        out += static_cast< char >(cp);
+    }
+    else if (cp < 0x800)
+    {
+        out += static_cast< char >(0xc0 | (cp >> 6));
+        out += static_cast< char >(0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000)
+    {
+        out += static_cast< char >(0xe0 | (cp >> 12));
+        out += static_cast< char >(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast< char >(0x80 | (cp & 0x3f));
+    }
+    else
+    {
+        out += static_cast< char >(0xf0 | (cp >> 18));
+        out += static_cast< char >(0x80 | ((cp >> 12) & 0x3f));
+        out += static_cast< char >(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast< char >(0x80 | (cp & 0x3f));
+    }
+}
+
+// Encodes the UTF-16 or UTF-32 code units [begin, end) as UTF-8, depending
+// on the size of CHAR_T, with unpaired surrogates replaced by U+FFFD.  If
+// |offsets| is given, the index of the code unit every byte comes from is
+// appended to it, followed by |end| - |begin|.
+template < typename CHAR_T >
+std::string utf8_encode(const CHAR_T *begin,
+                        const CHAR_T *end,
+                        std::vector< std::size_t > *offsets = nullptr)
+{
+    std::string out;
+    out.reserve(end - begin);
+
+    for (const CHAR_T *p = begin; p < end;)
+    {
+        const std::size_t size = out.size();
+        const CHAR_T *unit = p;
+        char32_t cp = static_cast< char32_t >(*p++);
+
+        if (cp >= 0xd800 && cp <= 0xdfff)
+        {
+            if (sizeof(CHAR_T) == 2 && cp <= 0xdbff && p < end &&
+                *p >= 0xdc00 && *p <= 0xdfff)
+            {
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (*p++ - 0xdc00);
+            }
+            else
+            {
+                cp = 0xfffd;
+            }
+        }
+        else if (cp > 0x10ffff)
+        {
+            cp = 0xfffd;
+        }
+
+        utf8_append(out, cp);
+
+        if (offsets)
+        {
+            offsets->insert(offsets->end(), out.size() - size, unit - begin);
+        }
+    }
+
+    if (offsets)
+    {
+        offsets->push_back(end - begin);
+    }
+
+    return out;
+}
+
+// Decodes the UTF-8 sequence at |p| into |cp| and returns its size, or 0 if
+// the sequence may be continued after |end|.  An invalid sequence yields
+// U+FFFD for as much of it as looked valid, and at least one byte.
+inline std::size_t utf8_decode(const unsigned char *p,
+                               const unsigned char *end,
+                               char32_t &cp)
+{
+    const unsigned char lead = *p;
+
+    if (lead < 0x80)
+    {
+        cp = lead;
+        return 1;
+    }
+
+    std::size_t size;
+    unsigned char low = 0x80;
+    unsigned char high = 0xbf;
+
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        size = 2;
+        cp = lead & 0x1f;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        size = 3;
+        cp = lead & 0x0f;
+        low = (lead == 0xe0) ? 0xa0 : 0x80;
+        high = (lead == 0xed) ? 0x9f : 0xbf;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        size = 4;
+        cp = lead & 0x07;
+        low = (lead == 0xf0) ? 0x90 : 0x80;
+        high = (lead == 0xf4) ? 0x8f : 0xbf;
+    }
+    else
+    {
+        cp = 0xfffd;
+        return 1;
+    }
+
+    for (std::size_t i = 1; i < size; ++i, low = 0x80, high = 0xbf)
+    {
+        if (p + i == end)
+        {
+            return 0;
+        }
+
+        if (p[i] < low || p[i] > high)
+        {
+            cp = 0xfffd;
+            return i;
+        }
+
+        cp = (cp << 6) | (p[i] & 0x3f);
+    }
+
+    return size;
+}
+
+// Decodes the UTF-8 string |s| into UTF-16 or UTF-32 code units, depending
+// on the size of CHAR_T, with invalid sequences replaced by U+FFFD.  For
+// char the bytes are kept as they are.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+std::basic_string< CHAR_T, TRAITS > utf8_widen(const std::string &s)
+{
+    std::basic_string< CHAR_T, TRAITS > wide;
+    wide.reserve(s.size());
+
+    const unsigned char *p =
+        reinterpret_cast< const unsigned char * >(s.data());
+    const unsigned char *end = p + s.size();
+
+    while (p < end)
+    {
+        char32_t cp = *p;
+        std::size_t size = 1;
+
+        if (sizeof(CHAR_T) > 1 && !(size = utf8_decode(p, end, cp)))
+        {
+            // cut short by the end of the string
+            cp = 0xfffd;
+            size = end - p;
+        }
+
+        if (sizeof(CHAR_T) == 2 && cp >= 0x10000)
+        {
+            wide += static_cast< CHAR_T >(0xd800 + ((cp - 0x10000) >> 10));
+            wide += static_cast< CHAR_T >(0xdc00 + ((cp - 0x10000) & 0x3ff));
+        }
+        else
+        {
+            wide += static_cast< CHAR_T >(cp);
+        }
+
+        p += size;
+    }
+
+    return wide;
+}
+}
+
+#endif
@@ -0,0 +1,191 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_UTF8_STREAMBUF_HPP
+#define INCLUDIZE_UTF8_STREAMBUF_HPP
+
+#include <cstring>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../decoding_streambuf.hpp"
+#include "utf8.hpp"
+
+namespace includize
+{
+// Decodes UTF-8 bytes a block at a time into UTF-16 code units or code
+// points, depending on the size of CHAR_T.  Invalid sequences are replaced
+// by U+FFFD and a byte order mark at the start is skipped.  Where SSE2 is
+// available, ASCII is widened 16 bytes at a time.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_utf8_streambuf : public basic_decoding_streambuf< CHAR_T, TRAITS >
+{
+public:
+    using decoding_type = basic_decoding_streambuf< CHAR_T, TRAITS >;
+    using char_type = typename decoding_type::char_type;
+
+public:
+    explicit basic_utf8_streambuf(std::unique_ptr< std::streambuf > bytes,
+                                  const std::string &read = std::string())
+        : decoding_type(std::move(bytes), block_size(), block_size(), read)
+    {
+    }
+
+protected:
+    std::size_t header_size() const override { return 3; }
+
+    std::size_t start(const unsigned char *in, std::size_t size) override
+    {
+        return (size >= 3 && std::memcmp(in, bom(), 3) == 0) ? 3 : 0;
+    }
+
+    // Every byte makes at most one character, so the output buffer is as
+    // big as the input buffer.
+    std::size_t decode(const unsigned char *in,
+                       std::size_t size,
+                       bool final,
+                       char_type *out,
+                       std::size_t &produced) override
+    {
+        const unsigned char *p = in;
+        const unsigned char *end = in + size;
+        char_type *o = out;
+
+        while (p < end)
+        {
+            const std::size_t ascii = decode_ascii(p, end, o);
+            p += ascii;
+            o += ascii;
+
+            for (; p < end && *p < 0x80; ++p)
+            {
+                *o++ = static_cast< char_type >(*p);
+            }
+
+            if (p == end)
+            {
+                break;
+            }
+
+            char32_t cp;
+            std::size_t n = utf8_decode(p, end, cp);
+
+            if (!n)
+            {
+                if (!final)
+                {
+                    break;
+                }
+
+                cp = 0xfffd;
+                n = end - p;
+            }
+
+            p += n;
+
+            if (sizeof(char_type) == 2 && cp >= 0x10000)
+            {
+                cp -= 0x10000;
+                *o++ = static_cast< char_type >(0xd800 + (cp >> 10));
+                *o++ = static_cast< char_type >(0xdc00 + (cp & 0x3ff));
+            }
+            else
+            {
+                *o++ = static_cast< char_type >(cp);
+            }
+        }
+
+        produced = o - out;
+        return p - in;
+    }
+
+private:
+    static constexpr std::size_t block_size() { return 8192; }
+
+    static const char *bom() { return "\xef\xbb\xbf"; }
+
+    // Widens blocks of 16 ASCII bytes from |in| on and returns how many
+    // bytes were widened.
+    static std::size_t decode_ascii(const unsigned char *in,
+                                    const unsigned char *end,
+                                    char_type *out)
+    {
+        std::size_t done = 0;
+#ifdef __SSE2__
+        if (sizeof(char_type) != 2 && sizeof(char_type) != 4)
+        {
+            return 0;
+        }
+
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; end - in >= 16; in += 16, done += 16)
+        {
+            const __m128i v =
+                _mm_loadu_si128(reinterpret_cast< const __m128i * >(in));
+
+            if (_mm_movemask_epi8(v))
+            {
+                break;
+            }
+
+            const __m128i lo = _mm_unpacklo_epi8(v, zero);
+            const __m128i hi = _mm_unpackhi_epi8(v, zero);
+            __m128i *o = reinterpret_cast< __m128i * >(out + done);
+
+            if (sizeof(char_type) == 2)
+            {
+                _mm_storeu_si128(o, lo);
+                _mm_storeu_si128(o + 1, hi);
+            }
+            else
+            {
+                _mm_storeu_si128(o, _mm_unpacklo_epi16(lo, zero));
+                _mm_storeu_si128(o + 1, _mm_unpackhi_epi16(lo, zero));
+                _mm_storeu_si128(o + 2, _mm_unpacklo_epi16(hi, zero));
+                _mm_storeu_si128(o + 3, _mm_unpackhi_epi16(hi, zero));
+            }
+        }
+#else
+        (void)in;
+        (void)end;
+        (void)out;
+#endif
+        return done;
+    }
+};
+}
+
+#endif
@@ -33,9 +33,15 @@
 
 #include <codecvt>
 #include <fstream>
+#include <memory>
+
+#include "utf16_streambuf.hpp"
 
 namespace includize
 {
+// The preparers decode the bytes of a file with prepare_utf16_streambuf().
+// prepare_ifstream() imbues the equivalent std::codecvt_utf16 facet for code
+// that reads the files through an ifstream of its own.
 struct wstream_utf16_header_preparer
 {
     static void prepare_ifstream(std::basic_ifstream< wchar_t > &s)
@@ -44,6 +50,13 @@ struct wstream_utf16_header_preparer
             s.getloc(),
             new std::codecvt_utf16< wchar_t, 0x10ffff, std::consume_header >));
     }
+
+    static std::unique_ptr< std::basic_streambuf< wchar_t > > prepare_streambuf(
+        std::unique_ptr< std::streambuf > bytes)
+    {
+        return prepare_utf16_streambuf< wchar_t >(std::move(bytes),
+                                                  utf16_byte_order::detect);
+    }
 };
 
 struct wstream_utf16_big_endian_preparer
@@ -53,6 +66,13 @@ struct wstream_utf16_big_endian_preparer
         s.imbue(std::locale(s.getloc(),
                             new std::codecvt_utf16< wchar_t, 0x10ffff >));
     }
+
+    static std::unique_ptr< std::basic_streambuf< wchar_t > > prepare_streambuf(
+        std::unique_ptr< std::streambuf > bytes)
+    {
+        return prepare_utf16_streambuf< wchar_t >(
+            std::move(bytes), utf16_byte_order::big_endian);
+    }
 };
 
 struct wstream_utf16_little_endian_preparer
@@ -63,6 +83,13 @@ struct wstream_utf16_little_endian_preparer
             s.getloc(),
             new std::codecvt_utf16< wchar_t, 0x10ffff, std::little_endian >));
     }
+
+    static std::unique_ptr< std::basic_streambuf< wchar_t > > prepare_streambuf(
+        std::unique_ptr< std::streambuf > bytes)
+    {
+        return prepare_utf16_streambuf< wchar_t >(
+            std::move(bytes), utf16_byte_order::little_endian);
+    }
 };
 }
 
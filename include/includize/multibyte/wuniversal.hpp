@@ -2,7 +2,7 @@
 #define INCLUDIZE_WUNIVERSAL_HPP
 
 #include "../universal.hpp"
-#include <codecvt>
+#include "utf8.hpp"
 
 namespace includize
 {
@@ -12,23 +12,30 @@ struct universal_spec< wchar_t >
     static constexpr wchar_t header_start() { return L'['; }
     static constexpr const wchar_t *regex()
     {
-        return LR"..(\[\s*#includize\s*"(([^"]|\")+)"\s*]])..";
+        return LR"..(\[\s*#includize).."
+               LR"..((?:_(if|unless)\s+([A-Za-z_][\w.]*)(?:=([^\s"\]]*))?)?).."
+               LR"..(\s*"(([^"]|\")+)").."
+               LR"..((?:\s+((lines|bytes)\s+\d+-\d*))?).."
+               LR"..((?:\s+with((?:\s+[A-Za-z_][\w.]*=[^\s"\]]*)+))?).."
+               LR"..(\s*]])..";
     }
 
-    static constexpr std::size_t file_name_index() { return 1; };
+    static constexpr const wchar_t *literal() { return L"#includize"; }
+    static constexpr std::size_t file_name_index() { return 4; };
+    static constexpr std::size_t range_index() { return 6; }
+    static constexpr std::size_t condition_index() { return 1; }
+    static constexpr std::size_t arguments_index() { return 8; }
 
     static constexpr bool discard_characters_after_include() { return true; }
 
     static std::string convert_filename(const std::wstring &str)
     {
-        std::wstring_convert< std::codecvt_utf8_utf16< wchar_t >, wchar_t >
-            converter;
-        return converter.to_bytes(str);
+        return utf8_encode(str.data(), str.data() + str.size());
     }
 
     static std::string unescape_filename(const std::string &str)
     {
-        return std::regex_replace(str, std::regex("\\\\\""), "\"");
+        return unescape_quotes(str);
     }
 };
 
@@ -0,0 +1,326 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_PREFETCH_STREAMBUF_HPP
+#define INCLUDIZE_PREFETCH_STREAMBUF_HPP
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "directory.hpp"
+#include "memory_streambuf.hpp"
+#include "resolver.hpp"
+
+namespace includize
+{
+// The characters of several files one after the other.  The files ahead of
+// the one being read are opened, decoded and have their first block read on
+// other threads, a few at a time, and are handed over in order as the
+// reader reaches them, so the reader only waits when it catches up with the
+// files being loaded.  The rest of a larger file is read block by block once
+// it is reached.  A file that does not end its last line is followed by a
+// newline, so that no line runs from one file into the next.  Files that
+// cannot be opened are skipped.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_prefetch_streambuf : public std::basic_streambuf< CHAR_T, TRAITS >
+{
+public:
+    using base_type = typename std::basic_streambuf< CHAR_T, TRAITS >;
+    using char_type = typename base_type::char_type;
+    using traits_type = typename base_type::traits_type;
+    using int_type = typename base_type::int_type;
+    using pos_type = typename base_type::pos_type;
+    using off_type = typename base_type::off_type;
+    using string_type = typename std::basic_string< char_type, traits_type >;
+    using memory_streambuf_type =
+        basic_memory_streambuf< char_type, traits_type >;
+    // turns the bytes of a file into characters
+    using prepare_function = std::function< std::unique_ptr< base_type >(
+        std::unique_ptr< std::streambuf >) >;
+
+public:
+    // Reads the files |names|, relative to |dir|, through |r|.
+    basic_prefetch_streambuf(std::shared_ptr< resolver > r,
+                             std::shared_ptr< const directory > dir,
+                             std::vector< std::string > names,
+                             prepare_function prepare)
+        : resolver_(std::move(r))
+        , dir_(std::move(dir))
+        , names_(std::move(names))
+        , prepare_(std::move(prepare))
+        , next_(0)
+        , started_(false)
+        , part_offset_(0)
+        , last_(newline())
+        , separator_(newline())
+    {
+        base_type::setg(nullptr, nullptr, nullptr);
+    }
+
+    basic_prefetch_streambuf(basic_prefetch_streambuf &) = delete;
+
+protected:
+    int_type underflow() override
+    {
+        while (base_type::gptr() == base_type::egptr())
+        {
+            if (!next_area())
+            {
+                return traits_type::eof();
+            }
+        }
+
+        return traits_type::to_int_type(*base_type::gptr());
+    }
+
+    pos_type seekoff(off_type off,
+                     std::ios_base::seekdir dir,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        const off_type current =
+            part_offset_ + (base_type::gptr() - base_type::eback());
+
+        if (dir == std::ios_base::cur)
+        {
+            return (off == 0) ? pos_type(current)
+                              : seekpos(pos_type(current + off), which);
+        }
+
+        return (dir == std::ios_base::beg) ? seekpos(pos_type(off), which)
+                                           : pos_type(off_type(-1));
+    }
+
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        const off_type target = off_type(pos);
+
+        if (!(which & std::ios_base::in) || target < 0)
+        {
+            return pos_type(off_type(-1));
+        }
+
+        if (target < part_offset_)
+        {
+            restart();
+        }
+
+        while (target >
+               part_offset_ + (base_type::egptr() - base_type::eback()))
+        {
+            if (!next_area())
+            {
+                return pos_type(off_type(-1));
+            }
+        }
+
+        base_type::setg(base_type::eback(),
+                        base_type::eback() + (target - part_offset_),
+                        base_type::egptr());
+        return pos;
+    }
+
+private:
+    static constexpr std::size_t lookahead() { return 8; }
+    static constexpr std::size_t block_size() { return 65536; }
+
+    static char_type newline() { return static_cast< char_type >('\n'); }
+
+    // A file as handed over by the thread that loaded it.
+    struct part
+    {
+        std::unique_ptr< base_type > source;
+        // |source| if its characters are in memory and served in place
+        memory_streambuf_type *memory;
+        // the first block of |source| otherwise
+        string_type head;
+    };
+
+    using part_type = std::unique_ptr< part >;
+
+    // Makes the next run of characters the get area: the first block of a
+    // file, a later block of it, or the newline that ends a file.
+    bool next_area()
+    {
+        if (base_type::egptr() != base_type::eback())
+        {
+            part_offset_ += base_type::egptr() - base_type::eback();
+            last_ = *(base_type::egptr() - 1);
+        }
+
+        base_type::setg(nullptr, nullptr, nullptr);
+
+        while (true)
+        {
+            if (part_ && !started_)
+            {
+                started_ = true;
+
+                const char_type *data = part_->memory
+                                            ? part_->memory->data()
+                                            : part_->head.data();
+                const std::size_t size = part_->memory ? part_->memory->size()
+                                                       : part_->head.size();
+
+                if (size)
+                {
+                    set_area(data, size);
+                    return true;
+                }
+            }
+
+            if (part_ && !part_->memory)
+            {
+                buffer_.resize(block_size());
+
+                const std::streamsize n =
+                    part_->source->sgetn(&buffer_[0], block_size());
+
+                if (n > 0)
+                {
+                    set_area(buffer_.data(), n);
+                    return true;
+                }
+            }
+
+            part_.reset();
+            fill();
+
+            if (pending_.empty())
+            {
+                return false;
+            }
+
+            part_ = pending_.front().get();
+            pending_.pop_front();
+            started_ = false;
+            fill();
+
+            if (part_ && part_offset_ > 0 &&
+                !traits_type::eq(last_, newline()))
+            {
+                set_area(&separator_, 1);
+                return true;
+            }
+        }
+    }
+
+    void set_area(const char_type *data, std::size_t size)
+    {
+        char_type *begin = const_cast< char_type * >(data);
+        base_type::setg(begin, begin, begin + size);
+    }
+
+    void fill()
+    {
+        while (pending_.size() < lookahead() && next_ < names_.size())
+        {
+            pending_.push_back(std::async(std::launch::async,
+                                          &basic_prefetch_streambuf::load,
+                                          resolver_,
+                                          dir_,
+                                          names_[next_++],
+                                          prepare_));
+        }
+    }
+
+    void restart()
+    {
+        pending_.clear();
+        part_.reset();
+        next_ = 0;
+        started_ = false;
+        part_offset_ = 0;
+        last_ = newline();
+        base_type::setg(nullptr, nullptr, nullptr);
+    }
+
+    // Runs on another thread, so only touches its arguments.
+    static part_type load(std::shared_ptr< resolver > r,
+                          std::shared_ptr< const directory > dir,
+                          std::string name,
+                          prepare_function prepare)
+    {
+        std::unique_ptr< std::streambuf > bytes = r->open(*dir, name);
+
+        if (!bytes)
+        {
+            return nullptr;
+        }
+
+        part_type loaded(new part);
+        loaded->source = prepare(std::move(bytes));
+
+        if (!loaded->source)
+        {
+            return nullptr;
+        }
+
+        loaded->memory =
+            dynamic_cast< memory_streambuf_type * >(loaded->source.get());
+
+        if (!loaded->memory)
+        {
+            loaded->head.resize(block_size());
+
+            const std::streamsize n =
+                loaded->source->sgetn(&loaded->head[0], block_size());
+
+            loaded->head.resize(std::max< std::streamsize >(n, 0));
+        }
+
+        return loaded;
+    }
+
+    std::shared_ptr< resolver > resolver_;
+    std::shared_ptr< const directory > dir_;
+    std::vector< std::string > names_;
+    prepare_function prepare_;
+    std::size_t next_;
+    std::deque< std::future< part_type > > pending_;
+    part_type part_;
+    // whether the first area of |part_| has been served
+    bool started_;
+    // later blocks of |part_|
+    string_type buffer_;
+    off_type part_offset_;
+    // the last character served before the get area
+    char_type last_;
+    char_type separator_;
+};
+}
+
+#endif
@@ -31,6 +31,7 @@
 #ifndef INCLUDIZE_PREPROCESSOR_HPP
 #define INCLUDIZE_PREPROCESSOR_HPP
 
+#include "memory_streambuf.hpp"
 #include "null_stream_preparer.hpp"
 #include "streambuf.hpp"
 
@@ -57,51 +58,45 @@ public:
                                             char_type,
                                             traits_type,
                                             stream_preparer_type >;
+    using memory_streambuf_type =
+        basic_memory_streambuf< char_type, traits_type >;
 
 public:
     basic_preprocessor(const std::string &file_name)
     {
-        std::string path = "";
-
-        if (file_name[0] != '/')
-        {
-            char buf[8192];
-            if (getcwd(buf, 8192))
-            {
-                std::string path = buf;
-
-                if (*path.rbegin() != '/')
-                {
-                    path += '/';
-                }
-            }
-        }
+        streambuf_.reset(new streambuf_type(file_name));
+        stream_.reset(new istream_type(streambuf_.get()));
+    }
 
-        path += extract_path(file_name);
+    // Expands text that is already in memory without copying it, so |data|
+    // must outlive the preprocessor.  Relative includes are resolved against
+    // |path|.
+    basic_preprocessor(const char_type *data,
+                       std::size_t size,
+                       const std::string &path = "")
+    {
+        memory_.reset(new memory_streambuf_type(data, size));
+        streambuf_.reset(new streambuf_type(*memory_, path));
+        stream_.reset(new istream_type(streambuf_.get()));
+    }
 
-        fstream_.reset(new ifstream_type(file_name.c_str(),
-                                         std::ios::in | std::ios::binary));
-        stream_preparer_type::prepare_ifstream(*fstream_);
-        streambuf_.reset(new streambuf_type(*fstream_, path));
+    // Expands an existing stream, which must outlive the preprocessor.
+    // Relative includes are resolved against |path|.
+    basic_preprocessor(istream_type &s, const std::string &path = "")
+    {
+        streambuf_.reset(new streambuf_type(s, path));
         stream_.reset(new istream_type(streambuf_.get()));
     }
 
     istream_type &stream() { return *stream_; }
 
+    streambuf_type &rdbuf() { return *streambuf_; }
+
     operator istream_type &() { return *stream_; }
 
 private:
-    static std::string extract_path(const std::string file_name)
-    {
-        std::string::size_type pos = file_name.rfind("/");
-        std::string path =
-            (pos != std::string::npos) ? file_name.substr(0, pos + 1) : "";
-
-        return path;
-    }
-
     std::unique_ptr< istream_type > stream_;
-    std::unique_ptr< ifstream_type > fstream_;
+    std::unique_ptr< memory_streambuf_type > memory_;
     std::unique_ptr< streambuf_type > streambuf_;
 };
 }
@@ -0,0 +1,305 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_RESOLVER_HPP
+#define INCLUDIZE_RESOLVER_HPP
+
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "directory.hpp"
+#include "fd_streambuf.hpp"
+#include "memory_streambuf.hpp"
+
+namespace includize
+{
+// Removes "." and ".." components and repeated separators so that
+// different spellings of a name find the same file.
+inline std::string normalize_path(const std::string &name)
+{
+    std::vector< std::string > parts;
+    std::string::size_type begin = 0;
+
+    while (begin <= name.size())
+    {
+        std::string::size_type end = name.find('/', begin);
+
+        if (end == std::string::npos)
+        {
+            end = name.size();
+        }
+
+        const std::string part = name.substr(begin, end - begin);
+
+        if (part == "..")
+        {
+            if (!parts.empty() && parts.back() != "..")
+            {
+                parts.pop_back();
+            }
+            else if (name.empty() || name[0] != '/')
+            {
+                parts.push_back(part);
+            }
+        }
+        else if (!part.empty() && part != ".")
+        {
+            parts.push_back(part);
+        }
+
+        begin = end + 1;
+    }
+
+    std::string normalized = (!name.empty() && name[0] == '/') ? "/" : "";
+
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+        normalized += (i ? "/" : "") + parts[i];
+    }
+
+    return normalized;
+}
+
+// Maps the name of a file to its contents.  Names are either absolute or
+// relative to the working directory, exactly as they would be passed to
+// std::ifstream, or relative to a directory.  The contents are returned as
+// raw bytes which the STREAM_PREPARER then turns into characters.
+//
+// Files matched by a wildcard include are opened from several threads at
+// once, so resolvers used with those must allow that.
+class resolver
+{
+public:
+    virtual ~resolver() {}
+
+    // Returns nullptr if |name| cannot be opened.
+    virtual std::unique_ptr< std::streambuf > open(const std::string &name) = 0;
+
+    // Opens |name| relative to |dir| unless it is absolute.  Resolvers that
+    // can make use of the descriptor of |dir| override this, the rest work
+    // with the joined path.
+    virtual std::unique_ptr< std::streambuf > open(const directory &dir,
+                                                   const std::string &name)
+    {
+        return open((name.size() && name[0] == '/') ? name : dir.path() + name);
+    }
+
+    // Returns the names of the files directly in the directory |path|, in
+    // any order.  Resolvers that cannot list directories return nothing.
+    virtual std::vector< std::string > list(const std::string &path)
+    {
+        (void)path;
+        return std::vector< std::string >();
+    }
+
+    // Lists |path| relative to |dir| unless it is absolute.
+    virtual std::vector< std::string > list(const directory &dir,
+                                            const std::string &path)
+    {
+        return list((path.size() && path[0] == '/') ? path : dir.path() + path);
+    }
+};
+
+// Reads files from the real filesystem, relative to the descriptor of the
+// including directory wherever there is one.
+class filesystem_resolver : public resolver
+{
+public:
+    std::unique_ptr< std::streambuf > open(const std::string &name) override
+    {
+        return open_at(AT_FDCWD, name);
+    }
+
+    std::unique_ptr< std::streambuf > open(const directory &dir,
+                                           const std::string &name) override
+    {
+        if (dir.fd() < 0)
+        {
+            return resolver::open(dir, name);
+        }
+
+        return open_at(dir.fd(), name);
+    }
+
+    std::vector< std::string > list(const std::string &path) override
+    {
+        return list_at(AT_FDCWD, path);
+    }
+
+    std::vector< std::string > list(const directory &dir,
+                                    const std::string &path) override
+    {
+        if (dir.fd() < 0)
+        {
+            return resolver::list(dir, path);
+        }
+
+        return list_at(dir.fd(), path);
+    }
+
+private:
+    static std::unique_ptr< std::streambuf > open_at(int at,
+                                                     const std::string &name)
+    {
+        const int fd = ::openat(at, name.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+
+        return std::unique_ptr< std::streambuf >(new fd_streambuf(fd));
+    }
+
+    static std::vector< std::string > list_at(int at, const std::string &path)
+    {
+        std::vector< std::string > names;
+        const int fd = ::openat(at,
+                                path.empty() ? "." : path.c_str(),
+                                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *d = (fd >= 0) ? ::fdopendir(fd) : nullptr;
+
+        if (!d)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+
+            return names;
+        }
+
+        while (const struct dirent *e = ::readdir(d))
+        {
+            bool file = (e->d_type == DT_REG);
+
+            if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK)
+            {
+                struct stat st;
+                file = ::fstatat(fd, e->d_name, &st, 0) == 0 &&
+                       S_ISREG(st.st_mode);
+            }
+
+            if (file)
+            {
+                names.push_back(e->d_name);
+            }
+        }
+
+        ::closedir(d);
+        return names;
+    }
+};
+
+// Serves files from memory.  Contents are handed out in place, so including
+// a file never copies it.
+class memory_resolver : public resolver
+{
+public:
+    using resolver::list;
+    using resolver::open;
+
+    // Adds a copy of |contents| as |name|.
+    void add(const std::string &name, std::string contents)
+    {
+        std::shared_ptr< std::string > owned =
+            std::make_shared< std::string >(std::move(contents));
+        files_[normalize_path(name)] =
+            entry{owned->data(), owned->size(), owned};
+    }
+
+    // Adds |size| bytes at |data| as |name| without copying them, e.g. for
+    // resources compiled into the program.  |data| must outlive every stream
+    // opened from it.
+    void add(const std::string &name, const char *data, std::size_t size)
+    {
+        files_[normalize_path(name)] = entry{data, size, nullptr};
+    }
+
+    std::unique_ptr< std::streambuf > open(const std::string &name) override
+    {
+        std::map< std::string, entry >::const_iterator it =
+            files_.find(normalize_path(name));
+
+        if (it == files_.end())
+        {
+            return nullptr;
+        }
+
+        return std::unique_ptr< std::streambuf >(new memory_streambuf(
+            it->second.data, it->second.size, it->second.owner));
+    }
+
+    std::vector< std::string > list(const std::string &path) override
+    {
+        std::string prefix = normalize_path(path);
+
+        if (prefix.size() && *prefix.rbegin() != '/')
+        {
+            prefix += "/";
+        }
+
+        std::vector< std::string > names;
+
+        for (std::map< std::string, entry >::const_iterator it =
+                 files_.lower_bound(prefix);
+             it != files_.end() && it->first.compare(
+                                       0, prefix.size(), prefix) == 0;
+             ++it)
+        {
+            if (it->first.find('/', prefix.size()) == std::string::npos)
+            {
+                names.push_back(it->first.substr(prefix.size()));
+            }
+        }
+
+        return names;
+    }
+
+private:
+    struct entry
+    {
+        const char *data;
+        std::size_t size;
+        std::shared_ptr< const void > owner;
+    };
+
+    std::map< std::string, entry > files_;
+};
+}
+
+#endif
@@ -0,0 +1,313 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_SLICE_STREAMBUF_HPP
+#define INCLUDIZE_SLICE_STREAMBUF_HPP
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <streambuf>
+#include <vector>
+
+namespace includize
+{
+// Positions |source| |offset| characters from its start.  Sources that cannot
+// seek there directly are rewound and read forward.
+template < typename CHAR_T, typename TRAITS >
+bool seek_characters(std::basic_streambuf< CHAR_T, TRAITS > &source,
+                     typename TRAITS::off_type offset)
+{
+    using pos_type = typename TRAITS::pos_type;
+    using off_type = typename TRAITS::off_type;
+
+    if (source.pubseekpos(pos_type(offset), std::ios_base::in) ==
+        pos_type(offset))
+    {
+        return true;
+    }
+
+    if (source.pubseekpos(0, std::ios_base::in) != pos_type(0))
+    {
+        return false;
+    }
+
+    CHAR_T skipped[4096];
+    const off_type size = sizeof(skipped) / sizeof(CHAR_T);
+
+    while (offset > 0)
+    {
+        const std::streamsize n = source.sgetn(
+            skipped,
+            static_cast< std::streamsize >(std::min< off_type >(offset, size)));
+
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        offset -= n;
+    }
+
+    return true;
+}
+
+// The characters [begin, end) of another stream buffer.  Positions are
+// relative to |begin|.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_slice_streambuf : public std::basic_streambuf< CHAR_T, TRAITS >
+{
+public:
+    using base_type = typename std::basic_streambuf< CHAR_T, TRAITS >;
+    using char_type = typename base_type::char_type;
+    using traits_type = typename base_type::traits_type;
+    using int_type = typename base_type::int_type;
+    using pos_type = typename base_type::pos_type;
+    using off_type = typename base_type::off_type;
+
+public:
+    basic_slice_streambuf(std::unique_ptr< base_type > source,
+                          off_type begin,
+                          off_type end)
+        : source_(std::move(source))
+        , begin_(begin)
+        , size_(std::max< off_type >(end - begin, 0))
+        , offset_(0)
+        , buffer_(block_size())
+        , good_(seek_characters(*source_, begin_))
+    {
+        base_type::setg(nullptr, nullptr, nullptr);
+    }
+
+    basic_slice_streambuf(basic_slice_streambuf &) = delete;
+
+protected:
+    int_type underflow() override
+    {
+        if (base_type::gptr() < base_type::egptr())
+        {
+            return traits_type::to_int_type(*base_type::gptr());
+        }
+
+        const std::streamsize n = read(buffer_.data(), buffer_.size());
+
+        if (n <= 0)
+        {
+            base_type::setg(nullptr, nullptr, nullptr);
+            return traits_type::eof();
+        }
+
+        base_type::setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+        return traits_type::to_int_type(*base_type::gptr());
+    }
+
+    // Reads straight into the caller's buffer once the get area is drained.
+    std::streamsize xsgetn(char_type *s, std::streamsize n) override
+    {
+        const std::streamsize buffered = std::min< std::streamsize >(
+            n, base_type::egptr() - base_type::gptr());
+
+        traits_type::copy(s, base_type::gptr(), buffered);
+        base_type::gbump(static_cast< int >(buffered));
+
+        if (buffered == n)
+        {
+            return n;
+        }
+
+        return buffered + std::max< std::streamsize >(
+                              read(s + buffered, n - buffered), 0);
+    }
+
+    pos_type seekoff(off_type off,
+                     std::ios_base::seekdir dir,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        const off_type current =
+            offset_ - (base_type::egptr() - base_type::gptr());
+
+        if (dir == std::ios_base::cur && off == 0)
+        {
+            return pos_type(current);
+        }
+
+        const off_type base = (dir == std::ios_base::beg)
+                                  ? 0
+                                  : (dir == std::ios_base::cur) ? current
+                                                                : size_;
+
+        return seekpos(pos_type(base + off), which);
+    }
+
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override
+    {
+        const off_type off = off_type(pos);
+
+        if (!(which & std::ios_base::in) || off < 0 || off > size_ ||
+            !seek_characters(*source_, begin_ + off))
+        {
+            return pos_type(off_type(-1));
+        }
+
+        good_ = true;
+        offset_ = off;
+        base_type::setg(nullptr, nullptr, nullptr);
+        return pos;
+    }
+
+private:
+    static constexpr std::size_t block_size() { return 8192; }
+
+    std::streamsize read(char_type *s, std::streamsize n)
+    {
+        n = std::min< std::streamsize >(n, size_ - offset_);
+
+        if (!good_ || n <= 0)
+        {
+            return 0;
+        }
+
+        const std::streamsize r = source_->sgetn(s, n);
+        offset_ += std::max< std::streamsize >(r, 0);
+        return r;
+    }
+
+    std::unique_ptr< base_type > source_;
+    off_type begin_;
+    off_type size_;
+    off_type offset_;
+    std::vector< char_type > buffer_;
+    bool good_;
+};
+
+// Where the lines of a source start, so that the start of a line can be found
+// without counting newlines from the top of the file every time.  The start
+// of every stride()-th line is recorded as far as the source has been
+// scanned, and the index grows as later lines are looked for.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_line_index
+{
+public:
+    using streambuf_type = typename std::basic_streambuf< CHAR_T, TRAITS >;
+    using char_type = CHAR_T;
+    using traits_type = TRAITS;
+    using off_type = typename traits_type::off_type;
+
+public:
+    basic_line_index() : starts_(1, 0), end_(-1) {}
+
+    // Returns the offset at which |line|, counted from 1, starts in |source|,
+    // or the size of |source| if it has fewer lines, or -1 if |source| could
+    // not be read.  |source| is left positioned anywhere.
+    off_type find(streambuf_type &source, std::size_t line)
+    {
+        line = std::max< std::size_t >(line, 1) - 1;
+
+        std::size_t i = std::min(line / stride(), starts_.size() - 1);
+
+        if (end_ >= 0 && line / stride() > i)
+        {
+            return end_;
+        }
+
+        off_type offset = starts_[i];
+        std::size_t current = i * stride();
+
+        if (current == line)
+        {
+            return offset;
+        }
+
+        if (!seek_characters(source, offset))
+        {
+            return -1;
+        }
+
+        std::vector< char_type > block(block_size());
+        const char_type newline = static_cast< char_type >('\n');
+
+        while (current < line)
+        {
+            const std::streamsize n = source.sgetn(block.data(), block.size());
+
+            if (n <= 0)
+            {
+                if (i + 1 == starts_.size())
+                {
+                    end_ = offset;
+                }
+
+                break;
+            }
+
+            const char_type *p = block.data();
+            const char_type *end = p + n;
+
+            while (current < line)
+            {
+                const char_type *eol = traits_type::find(p, end - p, newline);
+
+                if (!eol)
+                {
+                    break;
+                }
+
+                offset += eol + 1 - p;
+                p = eol + 1;
+
+                if (++current % stride() == 0 &&
+                    current / stride() == starts_.size())
+                {
+                    starts_.push_back(offset);
+                    ++i;
+                }
+            }
+
+            if (current < line)
+            {
+                offset += end - p;
+            }
+        }
+
+        return offset;
+    }
+
+private:
+    static constexpr std::size_t stride() { return 256; }
+    static constexpr std::size_t block_size() { return 8192; }
+
+    std::vector< off_type > starts_;
+    // the size of the source once it has been scanned to the end
+    off_type end_;
+};
+}
+
+#endif
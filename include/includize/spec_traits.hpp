@@ -0,0 +1,410 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_SPEC_TRAITS_HPP
+#define INCLUDIZE_SPEC_TRAITS_HPP
+
+#include <cstddef>
+#include <regex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "multibyte/utf8.hpp"
+
+namespace includize
+{
+// What a matched include directive asks for.
+template < typename CHAR_T >
+struct include_directive
+{
+    include_directive() : end(nullptr), discard(false), excluded(false) {}
+
+    std::string file_name;
+    // the range of the file to include, e.g. "lines 10-20", or empty
+    std::string range;
+    // the arguments of a template, e.g. "shard=3 region=eu", or empty
+    std::string arguments;
+    // where the directive ends, up to which it is replaced by the file
+    const CHAR_T *end;
+    // whether the rest of the line is dropped as well
+    bool discard;
+    // whether the condition of the directive ruled the file out, in which
+    // case no name is given
+    bool excluded;
+};
+
+// Replaces every \" in |str| with ", which is how the shipped specs escape
+// quotes in file names.
+inline std::string unescape_quotes(const std::string &str)
+{
+    std::string out;
+    out.reserve(str.size());
+
+    for (std::string::size_type i = 0; i < str.size(); ++i)
+    {
+        if (str[i] != '\\' || i + 1 == str.size() || str[i + 1] != '"')
+        {
+            out += str[i];
+        }
+    }
+
+    return out;
+}
+
+// How basic_streambuf finds and reads the directives of an INCLUDE_SPEC.
+//
+// The optional parts of a spec are given their defaults here, so that specs
+// written before those parts existed keep working unchanged.  A spec may
+// provide
+//
+//     static constexpr std::size_t range_index();
+//
+// the index of a regex group holding an optional range such as "lines 10-20"
+// or "bytes 0-4095", in which case only that part of the file is included,
+// and
+//
+//     static constexpr std::size_t condition_index();
+//
+// the index of a group holding an optional "if" or "unless", followed by a
+// group with the name of a variable and one with the value it is compared
+// with, if any.  The file is only included if the variable is defined (and
+// has that value), or with "unless" if it is not, and
+//
+//     static constexpr std::size_t arguments_index();
+//
+// the index of a group holding optional arguments such as "shard=3 region=eu"
+// that make the file a template, whose ${shard} and ${region} are replaced
+// with the values given, and
+//
+//     static constexpr bool line_anchored();
+//
+// which, if true, has directives only recognized at the start of a line,
+// after blanks, so that header starts elsewhere are passed over without
+// trying the regex, and
+//
+//     static constexpr const CHAR_T *literal();
+//
+// text that every directive holds after its header start, such as
+// "[[include".  Lines without it are rejected before the regex is tried.
+// Its characters are compared as they are widened to the character type of
+// the spec, so ASCII is enough whatever that type.
+//
+// The regex of a spec for char16_t or char32_t, which std::regex does not
+// support, is given in char and applied to the line encoded as UTF-8.
+template < typename INCLUDE_SPEC >
+struct include_spec_traits
+{
+    using char_type =
+        typename std::decay< decltype(INCLUDE_SPEC::header_start()) >::type;
+    using traits_type = std::char_traits< char_type >;
+    using directive_type = include_directive< char_type >;
+    using regex_char_type =
+        typename std::remove_cv< typename std::remove_pointer< decltype(
+            INCLUDE_SPEC::regex()) >::type >::type;
+
+    // 0 when the spec has no range group
+    static constexpr std::size_t range_index()
+    {
+        return range_index_of< INCLUDE_SPEC >(0);
+    }
+
+    // 0 when the spec has no conditions
+    static constexpr std::size_t condition_index()
+    {
+        return condition_index_of< INCLUDE_SPEC >(0);
+    }
+
+    // 0 when the spec has no template arguments
+    static constexpr std::size_t arguments_index()
+    {
+        return arguments_index_of< INCLUDE_SPEC >(0);
+    }
+
+    // false when the spec does not say
+    static constexpr bool line_anchored()
+    {
+        return line_anchored_of< INCLUDE_SPEC >(0);
+    }
+
+    // all the characters a directive can start with
+    static std::basic_string< char_type > header_starts()
+    {
+        return std::basic_string< char_type >(1, INCLUDE_SPEC::header_start());
+    }
+
+    static const char_type *find_header_start(const char_type *begin,
+                                              const char_type *end)
+    {
+        return traits_type::find(
+            begin, end - begin, INCLUDE_SPEC::header_start());
+    }
+
+    // Whether [begin, end) may hold a directive at all: it has a header start
+    // and, if the spec declares one, its literal.
+    static bool may_hold_directive(const char_type *begin,
+                                   const char_type *end)
+    {
+        return find_header_start(begin, end) &&
+               contains_literal< INCLUDE_SPEC >(begin, end, 0);
+    }
+
+    // Reads the directive, if any, in the line [begin, end) that starts with
+    // a header start.  A condition is decided by calling
+    //
+    //     holds(key, key_end, value, value_end)
+    //
+    // with |value| nullptr when there is nothing to compare with, before
+    // anything is done about the file.
+    template < typename CONDITION >
+    static bool match(const char_type *begin,
+                      const char_type *end,
+                      directive_type &directive,
+                      const CONDITION &holds)
+    {
+        if (begin == end || !traits_type::eq(*begin,
+                                             INCLUDE_SPEC::header_start()))
+        {
+            return false;
+        }
+
+        line_match m;
+
+        if (!contains_literal< INCLUDE_SPEC >(begin + 1, end, 0) ||
+            !search(begin + 1,
+                    end,
+                    m,
+                    std::is_same< char_type, regex_char_type >()))
+        {
+            return false;
+        }
+
+        directive.end = position(m, m.groups[0].second);
+        directive.discard = INCLUDE_SPEC::discard_characters_after_include();
+
+        const std::size_t c = condition_index();
+
+        if (c && m.groups[c].matched)
+        {
+            const bool unless = (*m.groups[c].first == 'u');
+            const bool compare = m.groups[c + 2].matched;
+
+            directive.excluded =
+                (holds(position(m, m.groups[c + 1].first),
+                       position(m, m.groups[c + 1].second),
+                       compare ? position(m, m.groups[c + 2].first) : nullptr,
+                       compare ? position(m, m.groups[c + 2].second)
+                               : nullptr) == unless);
+
+            if (directive.excluded)
+            {
+                return true;
+            }
+        }
+
+        directive.file_name = INCLUDE_SPEC::unescape_filename(
+            INCLUDE_SPEC::convert_filename(
+                m.groups[INCLUDE_SPEC::file_name_index()].str()));
+        directive.range = (range_index() && m.groups[range_index()].matched)
+                              ? INCLUDE_SPEC::convert_filename(
+                                    m.groups[range_index()].str())
+                              : std::string();
+        directive.arguments =
+            (arguments_index() && m.groups[arguments_index()].matched)
+                ? INCLUDE_SPEC::convert_filename(
+                      m.groups[arguments_index()].str())
+                : std::string();
+        return true;
+    }
+
+private:
+    // The groups of a directive, and the line they were matched in if it was
+    // encoded as UTF-8 for the regex.
+    struct line_match
+    {
+        std::match_results< const regex_char_type * > groups;
+        const char_type *begin;
+        std::basic_string< regex_char_type > encoded;
+        // the index in the line of the character every byte comes from
+        std::vector< std::size_t > offsets;
+    };
+
+    static bool search(const char_type *begin,
+                       const char_type *end,
+                       line_match &m,
+                       std::true_type)
+    {
+        return std::regex_search(begin, end, m.groups, regex());
+    }
+
+    static bool search(const char_type *begin,
+                       const char_type *end,
+                       line_match &m,
+                       std::false_type)
+    {
+        m.begin = begin;
+        m.encoded = utf8_encode(begin, end, &m.offsets);
+        return std::regex_search(m.encoded.data(),
+                                 m.encoded.data() + m.encoded.size(),
+                                 m.groups,
+                                 regex());
+    }
+
+    // where in the line |p| of the regex input is
+    static const char_type *position(const line_match &m,
+                                     const regex_char_type *p)
+    {
+        return position(m, p, std::is_same< char_type, regex_char_type >());
+    }
+
+    static const char_type *position(const line_match &,
+                                     const char_type *p,
+                                     std::true_type)
+    {
+        return p;
+    }
+
+    static const char_type *position(const line_match &m,
+                                     const regex_char_type *p,
+                                     std::false_type)
+    {
+        return m.begin + m.offsets[p - m.encoded.data()];
+    }
+
+    static const std::basic_regex< regex_char_type > &regex()
+    {
+        static const std::basic_regex< regex_char_type > r(
+            INCLUDE_SPEC::regex());
+        return r;
+    }
+
+    template < typename S >
+    static constexpr auto range_index_of(int) -> decltype(S::range_index())
+    {
+        return S::range_index();
+    }
+
+    template < typename S >
+    static constexpr std::size_t range_index_of(long)
+    {
+        return 0;
+    }
+
+    template < typename S >
+    static constexpr auto condition_index_of(int)
+        -> decltype(S::condition_index())
+    {
+        return S::condition_index();
+    }
+
+    template < typename S >
+    static constexpr std::size_t condition_index_of(long)
+    {
+        return 0;
+    }
+
+    template < typename S >
+    static auto contains_literal(const char_type *begin,
+                                 const char_type *end,
+                                 int) -> decltype(S::literal(), bool())
+    {
+        return contains(begin, end, S::literal());
+    }
+
+    template < typename S >
+    static bool contains_literal(const char_type *, const char_type *, long)
+    {
+        return true;
+    }
+
+    template < typename L >
+    static bool contains(const char_type *begin,
+                         const char_type *end,
+                         const L *literal)
+    {
+        const std::ptrdiff_t size = std::char_traits< L >::length(literal);
+
+        if (size == 0)
+        {
+            return true;
+        }
+
+        const char_type first = static_cast< char_type >(literal[0]);
+
+        for (const char_type *p = begin;
+             end - p >= size &&
+             (p = traits_type::find(p, end - p - size + 1, first));
+             ++p)
+        {
+            std::ptrdiff_t i = 1;
+
+            while (i < size &&
+                   traits_type::eq(p[i], static_cast< char_type >(literal[i])))
+            {
+                ++i;
+            }
+
+            if (i == size)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    template < typename S >
+    static constexpr auto line_anchored_of(int) -> decltype(S::line_anchored())
+    {
+        return S::line_anchored();
+    }
+
+    template < typename S >
+    static constexpr bool line_anchored_of(long)
+    {
+        return false;
+    }
+
+    template < typename S >
+    static constexpr auto arguments_index_of(int)
+        -> decltype(S::arguments_index())
+    {
+        return S::arguments_index();
+    }
+
+    template < typename S >
+    static constexpr std::size_t arguments_index_of(long)
+    {
+        return 0;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,119 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_STREAM_PREPARER_HPP
+#define INCLUDIZE_STREAM_PREPARER_HPP
+
+#include <fstream>
+#include <locale>
+#include <memory>
+#include <streambuf>
+#include <type_traits>
+
+#include "codecvt_streambuf.hpp"
+
+namespace includize
+{
+// Turns the raw bytes of a file into characters as a STREAM_PREPARER asks.
+//
+// A preparer may decode the bytes itself by providing
+//
+//     static std::unique_ptr< std::basic_streambuf< CHAR_T, TRAITS > >
+//     prepare_streambuf(std::unique_ptr< std::streambuf > bytes);
+//
+// Preparers that only provide prepare_ifstream() are asked to prepare an
+// ifstream once, and the conversion of the locale they imbue is then applied
+// to the bytes through a basic_codecvt_streambuf.  Bytes that need no
+// conversion are passed through untouched.
+template < typename STREAM_PREPARER, typename CHAR_T, typename TRAITS >
+struct stream_preparer_traits
+{
+    using streambuf_type = std::basic_streambuf< CHAR_T, TRAITS >;
+
+    static std::unique_ptr< streambuf_type > prepare(
+        std::unique_ptr< std::streambuf > bytes)
+    {
+        return prepare< STREAM_PREPARER >(std::move(bytes), 0);
+    }
+
+private:
+    template < typename P >
+    static auto prepare(std::unique_ptr< std::streambuf > bytes, int)
+        -> decltype(P::prepare_streambuf(std::move(bytes)))
+    {
+        return P::prepare_streambuf(std::move(bytes));
+    }
+
+    template < typename P >
+    static std::unique_ptr< streambuf_type > prepare(
+        std::unique_ptr< std::streambuf > bytes, long)
+    {
+        using codecvt_type = std::codecvt< CHAR_T, char, std::mbstate_t >;
+
+        if (std::use_facet< codecvt_type >(locale()).always_noconv())
+        {
+            return pass_through(
+                std::move(bytes),
+                std::is_same< streambuf_type, std::streambuf >());
+        }
+
+        return std::unique_ptr< streambuf_type >(
+            new basic_codecvt_streambuf< CHAR_T, TRAITS >(std::move(bytes),
+                                                          locale()));
+    }
+
+    static std::unique_ptr< streambuf_type > pass_through(
+        std::unique_ptr< std::streambuf > bytes, std::true_type)
+    {
+        return bytes;
+    }
+
+    static std::unique_ptr< streambuf_type > pass_through(
+        std::unique_ptr< std::streambuf > bytes, std::false_type)
+    {
+        return std::unique_ptr< streambuf_type >(
+            new basic_codecvt_streambuf< CHAR_T, TRAITS >(std::move(bytes),
+                                                          locale()));
+    }
+
+    static const std::locale &locale()
+    {
+        static const std::locale loc = []() {
+            std::basic_ifstream< CHAR_T, TRAITS > s;
+            STREAM_PREPARER::prepare_ifstream(s);
+            return s.getloc();
+        }();
+
+        return loc;
+    }
+};
+}
+
+#endif
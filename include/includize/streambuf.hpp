@@ -31,15 +31,37 @@
 #ifndef INCLUDIZE_STREAMBUF_HPP
 #define INCLUDIZE_STREAMBUF_HPP
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fnmatch.h>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
-#include <regex>
 #include <string>
+#include <typeinfo>
 #include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
+#include "char_set.hpp"
+#include "content_cache.hpp"
+#include "directory.hpp"
+#include "memory_streambuf.hpp"
+#include "multibyte/utf8.hpp"
 #include "null_stream_preparer.hpp"
+#include "prefetch_streambuf.hpp"
+#include "resolver.hpp"
+#include "slice_streambuf.hpp"
+#include "spec_traits.hpp"
+#include "stream_preparer.hpp"
+#include "variable_table.hpp"
+
+extern char **environ;
 
 namespace includize
 {
@@ -62,291 +84,1778 @@ public:
     using ifstream_type =
         typename std::basic_ifstream< char_type, traits_type >;
     using string_type = typename std::basic_string< char_type, traits_type >;
-    using regex_type = typename std::basic_regex< char_type >;
-    using regex_match_type =
-        typename std::match_results< typename string_type::const_iterator >;
+    using memory_streambuf_type =
+        basic_memory_streambuf< char_type, traits_type >;
+    using slice_streambuf_type =
+        basic_slice_streambuf< char_type, traits_type >;
+    using prefetch_streambuf_type =
+        basic_prefetch_streambuf< char_type, traits_type >;
+    using line_index_type = basic_line_index< char_type, traits_type >;
+    using spec_traits_type = include_spec_traits< include_spec_type >;
+    using directive_type = typename spec_traits_type::directive_type;
+    using variable_table_type = basic_variable_table< char_type, traits_type >;
+    using variable = typename variable_table_type::variable;
+    using preparer_traits_type =
+        stream_preparer_traits< stream_preparer_type, char_type, traits_type >;
 
 public:
     basic_streambuf(std::basic_istream< char_type, traits_type > &s,
                     const std::string &path = "")
-        : stream_(s)
-        , included_file_(NULL)
-        , included_file_pp_(NULL)
-        , included_stream_(NULL)
+        : basic_streambuf(*s.rdbuf(), path)
     {
-        base_type::setg(nullptr, nullptr, nullptr);
+    }
 
-        path_ = path;
+    basic_streambuf(base_type &source, const std::string &path = "")
+        : basic_streambuf()
+    {
+        std::unique_ptr< frame > root(
+            new frame(&source, directory::open(path)));
+        root->node = std::make_shared< frame_node >();
+        check_plain(*root);
+        frames_.push_back(std::move(root));
+    }
 
-        if (path.size() && !(*path.rbegin() == '/'))
-        {
-            path_ += "/";
-        }
+    // Expands the file |file_name|, which is opened through the resolver on
+    // the first read so that a resolver can still be set after construction.
+    // A relative name is taken relative to the working directory at the time
+    // of construction, and relative includes are resolved against the
+    // directory of the file.
+    explicit basic_streambuf(const std::string &file_name)
+        : basic_streambuf()
+    {
+        root_file_name_ = file_name;
+        root_directory_ = directory::open("");
     }
 
     basic_streambuf(basic_streambuf &&) = default;
     basic_streambuf(basic_streambuf &) = delete;
 
-    ~basic_streambuf() { remove_included_stream(); }
+    // Sets where the contents of included files come from.  The default
+    // reads them from the filesystem.
+    void set_resolver(std::shared_ptr< resolver > r)
+    {
+        resolver_ = r;
+        lookups_.clear();
+        line_indexes_.clear();
+        listings_.clear();
+    }
+
+    // Sets where the instances of templates are kept.  Streams that share a
+    // cache only render each instance once between them.
+    void set_content_cache(std::shared_ptr< content_cache > cache)
+    {
+        content_cache_ = cache;
+    }
+
+    // Adds a directory that relative includes are searched for in when they
+    // are not found next to the including file.  Directories are searched in
+    // the order they were added.
+    void add_include_path(const std::string &path)
+    {
+        include_paths_.push_back(directory::open(path));
+        lookups_.clear();
+    }
+
+    // Defines the variable |key| for conditional includes and substitution.
+    // Variables that are not defined here are looked up in the environment.
+    void define(const std::string &key, const std::string &value = "")
+    {
+        variables_changed_ = true;
+
+        typename std::vector< variable >::iterator it = std::lower_bound(
+            variables_.begin(),
+            variables_.end(),
+            key,
+            [](const variable &v, const std::string &k) {
+                return v.first < k;
+            });
+
+        if (it != variables_.end() && it->first == key)
+        {
+            it->second = value;
+        }
+        else
+        {
+            variables_.insert(it, variable(key, value));
+        }
+    }
+
+    // Replaces ${NAME} in the expanded text with the value of the variable
+    // NAME while scanning for directives.  Names that are not defined are
+    // left alone, and values are inserted as they are, without looking for
+    // directives or variables in them.  The environment is read when the
+    // first variable is substituted.
+    void enable_substitution(bool enable = true)
+    {
+        substitution_ = enable;
+        update_stops();
+    }
+
+    // Limits how far past a header start a directive is looked for, so that
+    // long lines are never buffered whole.  The rest of a line with a
+    // directive that discards it is dropped as it is read.  Sizes below
+    // min_lookahead() are raised to it, so that a directive with a file name
+    // of ordinary length always fits.
+    void set_lookahead(std::size_t size)
+    {
+        lookahead_ = std::max(size, min_lookahead());
+    }
+
+    static constexpr std::size_t min_lookahead() { return 256; }
+
+    // Replaces \r\n with \n in the expanded text while scanning for
+    // directives.  A \r that is not followed by \n is left alone.
+    void normalize_line_endings(bool enable = true)
+    {
+        normalize_line_endings_ = enable;
+        update_stops();
+    }
 
 protected:
-    int_type underflow() override
+    basic_streambuf()
+        : resolver_(std::make_shared< filesystem_resolver >())
+        , content_cache_(std::make_shared< content_cache >())
+        , checkpoint_spacing_(0)
+        , putback_(new char_type[putback_size()])
+        , suspended_eback_(nullptr)
+        , suspended_gptr_(nullptr)
+        , suspended_egptr_(nullptr)
+        , putback_mode_(false)
+        , area_offset_(0)
+        , variables_changed_(false)
+        , substitution_(false)
+        , normalize_line_endings_(false)
+        , lookahead_(default_lookahead())
     {
-        buffer_next();
+        base_type::setg(nullptr, nullptr, nullptr);
+    }
 
-        if (!included_buffer_.empty())
+    int_type underflow() override
+    {
+        if (base_type::gptr() < base_type::egptr())
         {
-            return *included_buffer_.begin();
+            return traits_type::to_int_type(*base_type::gptr());
         }
-        else if (!buffer_.empty())
+
+        if (putback_mode_)
         {
-            int_type c = *buffer_.begin();
-            buffer_.erase(buffer_.begin());
+            leave_putback_mode();
 
-            if (check_for_include(c))
+            if (base_type::gptr() < base_type::egptr())
             {
-                return buffer_next();
+                return traits_type::to_int_type(*base_type::gptr());
             }
-            else
-            {
-                buffer_.insert(0, 1, static_cast< char_type >(c));
-
-                if (buffer_.empty())
-                {
-                    buffer_next();
-                }
+        }
 
-                return c;
-            }
+        save_history();
+        area_offset_ += base_type::egptr() - base_type::eback();
+        base_type::setg(nullptr, nullptr, nullptr);
 
-            return *buffer_.begin();
+        if (next_run())
+        {
+            return traits_type::to_int_type(*base_type::gptr());
         }
 
         return traits_type::eof();
     }
 
-    int_type uflow() override
+    // Copies whole runs into the caller's buffer rather than going through
+    // uflow() a character at a time.
+    std::streamsize xsgetn(char_type *s, std::streamsize n) override
     {
-        underflow();
+        std::streamsize copied = 0;
 
-        if (!included_buffer_.empty())
+        while (copied < n)
         {
-            int_type c = *included_buffer_.begin();
-            included_buffer_.erase(included_buffer_.begin());
-
-            if (included_buffer_.empty())
+            if (base_type::gptr() == base_type::egptr() &&
+                traits_type::eq_int_type(underflow(), traits_type::eof()))
             {
-                underflow();
+                break;
             }
 
-            return c;
+            const std::streamsize count = std::min< std::streamsize >(
+                n - copied, base_type::egptr() - base_type::gptr());
+
+            traits_type::copy(s + copied, base_type::gptr(), count);
+            bump(count);
+            copied += count;
         }
 
-        if (!buffer_.empty())
+        return copied;
+    }
+
+    // Reports the characters of the current frame that are known to be
+    // plain text, i.e. everything up to the next possible directive.
+    std::streamsize showmanyc() override
+    {
+        if (putback_mode_)
         {
-            int_type c = *buffer_.begin();
-            buffer_.erase(buffer_.begin());
+            return suspended_egptr_ - suspended_gptr_;
+        }
 
-            if (check_for_include(c))
-            {
-                return uflow();
-            }
-            else
-            {
-                if (buffer_.empty())
-                {
-                    buffer_next();
-                }
+        if (frames_.empty())
+        {
+            return root_file_name_.empty() ? -1 : 0;
+        }
 
-                return c;
-            }
+        const frame &f = *frames_.back();
+
+        if (f.pos < f.size)
+        {
+            const char_type *begin = f.data + f.pos;
+            const char_type *end = f.data + f.size;
+            const char_type *p = find_stop(begin, end);
+
+            return (p ? p : end) - begin;
         }
 
-        return traits_type::eof();
+        return (f.eof && frames_.size() == 1) ? -1 : 0;
     }
 
-private:
-    int_type buffer_next()
+    int_type pbackfail(int_type c = traits_type::eof()) override
     {
-        if (included_file_pp_)
+        if (!putback_mode_)
         {
-            int_type c = included_stream_->get();
+            // The get area may be a view of a buffer we must not write to, so
+            // put back into a small area of our own holding the characters
+            // that were served just before the current position, and pick up
+            // the suspended get area again once it has been read through.
+            const std::size_t consumed = base_type::gptr() - base_type::eback();
+            const std::size_t n = std::min(putback_size(),
+                                           history_.size() + consumed);
 
-            if (c != traits_type::eof())
+            if (n == 0)
             {
-                included_buffer_.push_back(c);
-                return *included_buffer_.begin();
+                return traits_type::eof();
             }
 
-            remove_included_stream();
+            const std::size_t from_area = std::min(n, consumed);
+            const std::size_t from_history = n - from_area;
+
+            traits_type::copy(putback_.get(),
+                              history_.data() + history_.size() - from_history,
+                              from_history);
+            traits_type::copy(putback_.get() + from_history,
+                              base_type::gptr() - from_area,
+                              from_area);
+
+            suspended_eback_ = base_type::eback();
+            suspended_gptr_ = base_type::gptr();
+            suspended_egptr_ = base_type::egptr();
+            putback_mode_ = true;
+
+            base_type::setg(
+                putback_.get(), putback_.get() + n, putback_.get() + n);
         }
 
-        int_type c = get_next_from_stream();
+        if (base_type::gptr() == base_type::eback())
+        {
+            return traits_type::eof();
+        }
 
-        if (c != traits_type::eof())
+        base_type::gbump(-1);
+
+        if (traits_type::eq_int_type(c, traits_type::eof()))
         {
-            buffer_.push_back(c);
-            return *buffer_.begin();
+            return traits_type::to_int_type(*base_type::gptr());
         }
 
-        assert(c == traits_type::eof());
+        *base_type::gptr() = traits_type::to_char_type(c);
         return c;
     }
 
-    int_type get_next_from_stream()
+    pos_type seekoff(off_type off,
+                     std::ios_base::seekdir dir,
+                     std::ios_base::openmode which = std::ios_base::in) override
     {
-        if (stream_.good())
+        if (!(which & std::ios_base::in))
         {
-            const int_type c = stream_.get();
-            return c;
+            return pos_type(off_type(-1));
         }
 
-        return traits_type::eof();
+        switch (dir)
+        {
+            case std::ios_base::beg:
+                return seekpos(pos_type(off), which);
+            case std::ios_base::cur:
+                return (off == 0) ? pos_type(tell())
+                                  : seekpos(pos_type(tell() + off), which);
+            default:
+                while (underflow() != traits_type::eof())
+                {
+                    base_type::setg(base_type::eback(),
+                                    base_type::egptr(),
+                                    base_type::egptr());
+                }
+
+                return seekpos(pos_type(tell() + off), which);
+        }
     }
 
-    void remove_included_stream()
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override
     {
-        if (included_file_pp_)
+        const off_type target = off_type(pos);
+
+        if (!(which & std::ios_base::in) || target < 0)
+        {
+            return pos_type(off_type(-1));
+        }
+
+        if (putback_mode_)
+        {
+            leave_putback_mode();
+        }
+
+        const off_type area_size = base_type::egptr() - base_type::eback();
+
+        if (target >= area_offset_ && target <= area_offset_ + area_size)
+        {
+            base_type::setg(base_type::eback(),
+                            base_type::eback() + (target - area_offset_),
+                            base_type::egptr());
+            return pos;
+        }
+
+        if (target < area_offset_)
         {
-            delete included_stream_;
-            delete included_file_pp_;
-            delete included_file_;
+            // Resume from the last checkpoint at or before the target rather
+            // than re-expanding everything from the start.
+            typename std::vector< checkpoint >::const_iterator it =
+                std::upper_bound(
+                    checkpoints_.begin(),
+                    checkpoints_.end(),
+                    target,
+                    [](off_type t, const checkpoint &c) {
+                        return t < c.output;
+                    });
 
-            included_stream_ = nullptr;
-            included_file_pp_ = nullptr;
-            included_file_ = nullptr;
+            if (it == checkpoints_.begin() || !restore(*(--it)))
+            {
+                return pos_type(off_type(-1));
+            }
         }
+
+        return advance(target - tell()) ? pos : pos_type(off_type(-1));
     }
 
-    bool open_included_stream(const string_type &file_name)
+private:
+    // A position within the source of a frame.  |base| is a position
+    // reported by the source itself and |skip| the number of characters to
+    // read past it, so we never need to do arithmetic on a pos_type that came
+    // from a stateful conversion.  |offset| counts characters from the start
+    // of the source and is used when the source cannot seek to |base|.
+    // |discard_line| is set if the rest of the line there belongs to a
+    // directive and is dropped, and |blank_line| if only blanks precede it
+    // on its line.
+    struct location
+    {
+        location()
+            : base(off_type(-1))
+            , skip(0)
+            , offset(0)
+            , discard_line(false)
+            , blank_line(true)
+        {
+        }
+
+        pos_type base;
+        std::size_t skip;
+        std::size_t offset;
+        bool discard_line;
+        bool blank_line;
+    };
+
+    // The part of a file an include is limited to.  |first| and |last| are
+    // inclusive; lines count from 1 and bytes from 0.
+    struct include_range
+    {
+        enum unit_type
+        {
+            all,
+            bytes,
+            lines
+        };
+
+        include_range() : unit(all), first(0), last(open_end()) {}
+
+        static constexpr std::size_t open_end() { return std::size_t(-1); }
+
+        unit_type unit;
+        std::size_t first;
+        std::size_t last;
+    };
+
+    // An immutable record of how a frame was opened, kept alive by the seek
+    // index so that an included file can be reopened when seeking back into
+    // it.
+    struct frame_node
+    {
+        std::shared_ptr< const frame_node > parent;
+        std::shared_ptr< const directory > dir;
+        std::string file_name;
+        include_range range;
+        std::string arguments;
+        location resume;
+    };
+
+    // An entry in the seek index: expanding from |loc| within the frame
+    // described by |node| produces output starting at |output|.
+    struct checkpoint
     {
-        std::string name = include_spec_type::unescape_filename(
-            include_spec_type::convert_filename(file_name));
+        off_type output;
+        std::shared_ptr< const frame_node > node;
+        location loc;
+    };
 
-        std::string path = get_file_path(name);
+    struct frame
+    {
+        frame(base_type *s, std::shared_ptr< const directory > d)
+            : source(s)
+            , memory(dynamic_cast< memory_streambuf_type * >(s))
+            , dir(d)
+            , data(nullptr)
+            , size(0)
+            , pos(0)
+            , seekable(true)
+            , eof(false)
+            , discard_line(false)
+            , blank_line(true)
+            , plain(false)
+            , plain_end(0)
+        {
+        }
 
-        if (name[0] != '/')
+        location at(std::size_t p) const
         {
-            name = path_ + name;
+            location l = loc;
+            l.skip += p;
+            l.offset += p;
+            l.discard_line = discard_line;
+            l.blank_line = blank_line;
+            return l;
         }
 
-        included_file_ =
-            new ifstream_type(name.c_str(), std::ios::in | std::ios::binary);
-        stream_preparer_type::prepare_ifstream(*included_file_);
-        included_file_pp_ = new basic_streambuf(*included_file_, path);
-        included_stream_ = new istream_type(included_file_pp_);
+        std::unique_ptr< base_type > owned;
+        base_type *source;
+        memory_streambuf_type *memory;
+        std::shared_ptr< const directory > dir;
+        std::shared_ptr< const frame_node > node;
+        string_type buffer;
+        // the window being scanned, either |buffer| or the memory of the
+        // source itself
+        const char_type *data;
+        std::size_t size;
+        std::size_t pos;
+        location loc;
+        bool seekable;
+        bool eof;
+        // whether the rest of the current line is dropped
+        bool discard_line;
+        // whether only blanks precede |pos| on its line, kept for line
+        // anchored specs
+        bool blank_line;
+        // whether the source holds no directives and is served as it is
+        bool plain;
+        // the end of the lines at the start of the window that hold no
+        // directives
+        std::size_t plain_end;
+    };
 
-        if (included_stream_->good())
+    static constexpr std::size_t block_size() { return 8192; }
+    static constexpr std::size_t max_checkpoints() { return 4096; }
+    static constexpr std::size_t default_lookahead() { return 4096; }
+    static constexpr std::size_t putback_size() { return 16; }
+
+    static char_type newline() { return static_cast< char_type >('\n'); }
+
+    off_type tell() const
+    {
+        if (putback_mode_)
         {
-            buffer_next();
-            return true;
+            return area_offset_ + (suspended_gptr_ - suspended_eback_) -
+                   (base_type::egptr() - base_type::gptr());
         }
 
-        return false;
+        return area_offset_ + (base_type::gptr() - base_type::eback());
     }
 
-    void buffer_line_from_stream()
+    void leave_putback_mode()
     {
-        do
+        const off_type pending =
+            std::min< off_type >(base_type::egptr() - base_type::gptr(),
+                                 suspended_gptr_ - suspended_eback_);
+
+        base_type::setg(
+            suspended_eback_, suspended_gptr_ - pending, suspended_egptr_);
+        putback_mode_ = false;
+    }
+
+    // Remembers the tail of the get area that is about to be replaced so
+    // characters can be put back across run and include boundaries.
+    void save_history()
+    {
+        const std::size_t n =
+            std::min< std::size_t >(base_type::egptr() - base_type::eback(),
+                                    putback_size());
+
+        history_.append(base_type::egptr() - n, n);
+
+        if (history_.size() > putback_size())
         {
-            int_type c = get_next_from_stream();
+            history_.erase(0, history_.size() - putback_size());
+        }
+    }
 
-            if (c == traits_type::eof())
-            {
-                break;
-            }
-            else if (static_cast< char_type >(c) != stream_.widen('\n'))
-            {
-                buffer_.push_back(c);
-            }
-            else
+    bool advance(off_type n)
+    {
+        while (n > 0)
+        {
+            if (underflow() == traits_type::eof())
             {
-                buffer_.push_back(c);
-                break;
+                return false;
             }
-        } while (true);
+
+            const off_type step =
+                std::min< off_type >(n, base_type::egptr() - base_type::gptr());
+            bump(step);
+            n -= step;
+        }
+
+        return true;
     }
 
-    bool check_for_include(int_type c)
+    // Moves the position in the get area forward by |n|.  gbump() takes an
+    // int, which an in-memory file served in one piece may outgrow.
+    void bump(off_type n)
     {
-        if (c == include_spec_type::header_start())
+        while (n > 0)
         {
-            string_type line;
-
-            typename string_type::size_type pos = string_type::npos;
+            const int step = static_cast< int >(std::min< off_type >(
+                n, std::numeric_limits< int >::max()));
+            base_type::gbump(step);
+            n -= step;
+        }
+    }
 
-            if (!buffer_.empty())
+    // Produces the next run of output as the get area.  Plain text is served
+    // straight out of the buffer of the frame it was read into.
+    bool next_run()
+    {
+        if (frames_.empty())
+        {
+            if (root_file_name_.empty() ||
+                !open_included_stream(root_directory_,
+                                      root_file_name_,
+                                      include_range(),
+                                      std::string()))
             {
-                pos = buffer_.find(stream_.widen('\n'));
+                root_file_name_.clear();
+                root_directory_.reset();
+                return false;
+            }
 
-                if (pos != string_type::npos)
-                {
-                    line = buffer_.substr(0, pos);
-                }
-                else
+            root_file_name_.clear();
+            root_directory_.reset();
+            frames_.back()->node = std::make_shared< frame_node >();
+        }
+
+        while (true)
+        {
+            frame &f = *frames_.back();
+
+            if (f.pos == f.size)
+            {
+                if (!read_block(f, false))
                 {
-                    buffer_line_from_stream();
-                    line = buffer_;
+                    if (frames_.size() == 1)
+                    {
+                        return false;
+                    }
+
+                    frames_.pop_back();
+                    add_checkpoint();
+                    continue;
                 }
+
+                add_checkpoint();
             }
-            else
+
+            if (f.discard_line)
             {
-                buffer_line_from_stream();
-                line = buffer_;
+                const char_type *eol = traits_type::find(
+                    f.data + f.pos, f.size - f.pos, newline());
+
+                f.pos = eol ? (eol - f.data) : f.size;
+                f.discard_line = !eol;
+                continue;
             }
 
-            regex_match_type match;
+            const char_type *begin = f.data + f.pos;
+            const char_type *end = f.data + f.size;
+            const char_type *p = nullptr;
 
-            if (std::regex_search(
-                    line, match, regex_type(include_spec_type::regex())))
+            if (stops_ || (!f.plain && f.pos >= f.plain_end))
+            {
+                p = next_stop(f, begin, end);
+            }
+            else if (!f.plain)
             {
-                string_type file_name =
-                    match[include_spec_type::file_name_index()];
+                p = f.data + f.plain_end;
+            }
 
-                if (pos != string_type::npos && pos < buffer_.size())
+            if (p == begin)
+            {
+                if (is_header_start(*begin) && check_for_include(f))
                 {
-                    buffer_.erase(0, pos);
+                    continue;
                 }
-                else
+
+                // buffer may have been extended looking for the end of line
+                if (normalize_line_endings_ &&
+                    traits_type::eq(f.data[f.pos], carriage_return()) &&
+                    skip_carriage_return(f))
                 {
-                    buffer_.clear();
+                    continue;
                 }
 
-                if (!include_spec_type::discard_characters_after_include())
+                if (substitution_ && traits_type::eq(f.data[f.pos], dollar()) &&
+                    substitute(f))
                 {
-                    buffer_ += match.suffix();
+                    if (base_type::gptr() < base_type::egptr())
+                    {
+                        return true;
+                    }
+
+                    continue;
                 }
 
-                return open_included_stream(file_name);
+                begin = f.data + f.pos;
+                end = f.data + f.size;
+                p = next_stop(f, begin + 1, end);
+            }
+
+            if (!p)
+            {
+                p = end;
+            }
+
+            if (spec_traits_type::line_anchored())
+            {
+                f.blank_line = starts_line(f, p);
+            }
+
+            base_type::setg(const_cast< char_type * >(begin),
+                            const_cast< char_type * >(begin),
+                            const_cast< char_type * >(p));
+            f.pos += p - begin;
+            return true;
+        }
+    }
+
+    // The characters the scan stops at: those that may start a directive
+    // and, when enabled, a variable or a \r\n.  Without either the spec
+    // finds its header starts itself.
+    void update_stops()
+    {
+        std::basic_string< char_type > stops =
+            spec_traits_type::header_starts();
+
+        if (substitution_)
+        {
+            stops += dollar();
+        }
+
+        if (normalize_line_endings_)
+        {
+            stops += carriage_return();
+        }
+
+        stops_.reset((substitution_ || normalize_line_endings_)
+                         ? new char_set< char_type >(stops)
+                         : nullptr);
+    }
+
+    // Finds the next stop from |from| on in the window of |f|.  For line
+    // anchored specs, header starts that follow anything but blanks on their
+    // line are passed over, and without other stops so is the rest of their
+    // line.
+    const char_type *next_stop(const frame &f,
+                               const char_type *from,
+                               const char_type *end) const
+    {
+        const char_type *p = find_stop(from, end);
+
+        if (!spec_traits_type::line_anchored())
+        {
+            return p;
+        }
+
+        while (p && is_header_start(*p) && !starts_line(f, p))
+        {
+            if (stops_)
+            {
+                p = find_stop(p + 1, end);
+                continue;
+            }
+
+            const char_type *eol = traits_type::find(p, end - p, newline());
+            p = eol ? find_stop(eol + 1, end) : nullptr;
+        }
+
+        return p;
+    }
+
+    // Whether only spaces and tabs precede |p| on its line.  Only the window
+    // of |f| from its position on is looked at, and what came before is
+    // known from the frame.
+    bool starts_line(const frame &f, const char_type *p) const
+    {
+        const char_type *begin = f.data + f.pos;
+
+        while (p > begin)
+        {
+            --p;
+
+            if (traits_type::eq(*p, newline()))
+            {
+                return true;
+            }
+
+            if (!traits_type::eq(*p, static_cast< char_type >(' ')) &&
+                !traits_type::eq(*p, static_cast< char_type >('\t')))
+            {
+                return false;
             }
         }
 
+        return f.blank_line;
+    }
+
+    // Finds the next character the scan stops at.
+    const char_type *find_stop(const char_type *begin,
+                               const char_type *end) const
+    {
+        return stops_ ? stops_->find(begin, end)
+                      : spec_traits_type::find_header_start(begin, end);
+    }
+
+    static bool is_header_start(char_type c)
+    {
+        static const char_set< char_type > starts(
+            spec_traits_type::header_starts());
+        return starts.contains(c);
+    }
+
+    static char_type dollar() { return static_cast< char_type >('$'); }
+
+    static char_type carriage_return()
+    {
+        return static_cast< char_type >('\r');
+    }
+
+    // Skips the \r at the position of |f| if a \n follows it, which may be
+    // in the next block.
+    bool skip_carriage_return(frame &f)
+    {
+        if (f.pos + 1 == f.size)
+        {
+            read_block(f, true);
+        }
+
+        if (f.pos + 1 < f.size &&
+            traits_type::eq(f.data[f.pos + 1], newline()))
+        {
+            ++f.pos;
+            return true;
+        }
+
         return false;
     }
 
-    std::string get_file_path(const std::string file_name)
+    static constexpr std::size_t max_variable_name_size() { return 256; }
+
+    // Serves the value of the ${NAME} at the position of |f| as the get
+    // area, and returns false if there is no variable there.
+    bool substitute(frame &f)
+    {
+        const std::size_t limit = max_variable_name_size() + 3;
+        const char_type close = static_cast< char_type >('}');
+        const char_type *end = nullptr;
+
+        while (!(end = traits_type::find(f.data + f.pos,
+                                         std::min(f.size - f.pos, limit),
+                                         close)) &&
+               f.size - f.pos < limit && read_block(f, true))
+        {
+        }
+
+        const char_type *begin = f.data + f.pos;
+
+        if (!end || end - begin < 3 ||
+            !traits_type::eq(begin[1], static_cast< char_type >('{')))
+        {
+            return false;
+        }
+
+        // the table is only rebuilt here, once the get area has left any
+        // value served from it
+        if (!variable_table_ || variables_changed_)
+        {
+            variable_table_.reset(new variable_table_type(all_variables()));
+            variables_changed_ = false;
+        }
+
+        const string_type *value = variable_table_->find(begin + 2, end);
+
+        if (!value)
+        {
+            return false;
+        }
+
+        f.pos = end + 1 - f.data;
+        f.blank_line = false;
+
+        char_type *data = const_cast< char_type * >(value->data());
+        base_type::setg(data, data, data + value->size());
+        return true;
+    }
+
+    // The environment, overridden by the variables defined on the stream.
+    std::vector< variable > all_variables() const
     {
-        if (file_name.length())
+        std::map< std::string, std::string > all;
+
+        for (char **e = environ; e && *e; ++e)
         {
-            std::string::size_type pos = file_name.rfind("/");
-            std::string path =
-                (pos != std::string::npos) ? file_name.substr(0, pos + 1) : "";
+            const char *eq = std::strchr(*e, '=');
+
+            if (eq)
+            {
+                all.insert(variable(std::string(*e, eq - *e), eq + 1));
+            }
+        }
 
-            return (file_name[0] != '/') ? path_ + path : path;
+        for (const variable &v : variables_)
+        {
+            all[v.first] = v.second;
         }
 
-        return "";
+        return std::vector< variable >(all.begin(), all.end());
     }
 
+    // Reads the next block from the source of |f|.  If |append| is set the
+    // unconsumed part of the current buffer is kept and the block is added
+    // after it, otherwise the buffer is replaced and checked for lines
+    // without directives.  Memory sources are handed out in place as a
+    // single block.
+    bool read_block(frame &f, bool append)
+    {
+        if (f.eof || (append && f.memory))
+        {
+            return false;
+        }
+
+        if (append)
+        {
+            f.buffer.erase(0, f.pos);
+            f.loc = f.at(f.pos);
+        }
+        else
+        {
+            f.loc = f.at(f.size);
+            f.buffer.clear();
+
+            if (f.seekable)
+            {
+                f.loc.base = f.source->pubseekoff(
+                    0, std::ios_base::cur, std::ios_base::in);
+                f.loc.skip = 0;
+                f.seekable = (f.loc.base != pos_type(off_type(-1)));
+            }
+        }
+
+        f.pos = 0;
+        f.plain_end = 0;
+
+        std::streamsize n = 0;
+
+        if (f.memory)
+        {
+            const off_type offset = f.memory->pubseekoff(
+                0, std::ios_base::cur, std::ios_base::in);
+
+            f.data = f.memory->data() + offset;
+            f.size = f.memory->size() - offset;
+            f.memory->pubseekoff(0, std::ios_base::end, std::ios_base::in);
+            n = f.size;
+        }
+        else
+        {
+            const std::size_t size = f.buffer.size();
+            f.buffer.resize(size + block_size());
+
+            try
+            {
+                n = f.source->sgetn(&f.buffer[size], block_size());
+            }
+            catch (...)
+            {
+                // sources report errors such as corrupt compressed data by
+                // throwing, which the istream turns into badbit
+                f.buffer.resize(size);
+                f.data = f.buffer.data();
+                f.size = f.buffer.size();
+                throw;
+            }
+
+            f.buffer.resize(size + std::max< std::streamsize >(n, 0));
+
+            f.data = f.buffer.data();
+            f.size = f.buffer.size();
+        }
+
+        if (n <= 0)
+        {
+            f.eof = true;
+            return false;
+        }
+
+        if (!append && !f.memory)
+        {
+            check_plain_lines(f);
+        }
+
+        return true;
+    }
+
+    // Records where the output at the start of the get area comes from.  At
+    // most max_checkpoints() are kept: when there are that many every other
+    // one is dropped and later ones are spaced twice as far apart.  The index
+    // thus stays the same size however long the input is, at the cost of
+    // re-expanding more after seeking back into a long input.
+    void add_checkpoint()
+    {
+        if (!checkpoints_.empty() &&
+            area_offset_ - checkpoints_.back().output <= checkpoint_spacing_)
+        {
+            return;
+        }
+
+        if (checkpoints_.size() == max_checkpoints())
+        {
+            for (std::size_t i = 1; 2 * i < checkpoints_.size(); ++i)
+            {
+                checkpoints_[i] = std::move(checkpoints_[2 * i]);
+            }
+
+            checkpoints_.resize((checkpoints_.size() + 1) / 2);
+            checkpoint_spacing_ = checkpoint_spacing_
+                                      ? 2 * checkpoint_spacing_
+                                      : off_type(2 * block_size());
+        }
+
+        const frame &f = *frames_.back();
+        checkpoint c;
+        c.output = area_offset_;
+        c.node = f.node;
+        c.loc = f.at(f.pos);
+        checkpoints_.push_back(c);
+    }
+
+    bool seek_frame(frame &f, const location &l)
+    {
+        location from = l;
+
+        if (l.base == pos_type(off_type(-1)) ||
+            f.source->pubseekpos(l.base, std::ios_base::in) != l.base)
+        {
+            // fall back to reading from the start of the source
+            if (f.source->pubseekpos(0, std::ios_base::in) != pos_type(0))
+            {
+                return false;
+            }
+
+            from.base = pos_type(0);
+            from.skip = from.offset;
+        }
+
+        f.buffer.clear();
+        f.size = 0;
+        f.pos = 0;
+        f.eof = false;
+        f.loc = from;
+        f.loc.skip = 0;
+        f.loc.offset = from.offset - from.skip;
+
+        std::size_t skip = from.skip;
+
+        while (read_block(f, false))
+        {
+            if (skip < f.size)
+            {
+                break;
+            }
+
+            skip -= f.size;
+            f.pos = f.size;
+        }
+
+        f.pos = std::min(skip, f.size);
+        f.discard_line = l.discard_line;
+        f.blank_line = l.blank_line;
+        return true;
+    }
+
+    bool restore(const checkpoint &c)
+    {
+        std::vector< const frame_node * > chain;
+
+        for (const frame_node *n = c.node.get(); n; n = n->parent.get())
+        {
+            chain.insert(chain.begin(), n);
+        }
+
+        if (frames_.empty())
+        {
+            return false;
+        }
+
+        frames_.resize(1);
+
+        for (std::size_t i = 0; i < chain.size(); ++i)
+        {
+            if (i && !open_included_stream(chain[i]->dir,
+                                           chain[i]->file_name,
+                                           chain[i]->range,
+                                           chain[i]->arguments))
+            {
+                return false;
+            }
+
+            frames_.back()->node = (i ? std::shared_ptr< const frame_node >(
+                                            c.node, chain[i])
+                                      : frames_.back()->node);
+
+            if (!seek_frame(*frames_.back(),
+                            (i + 1 < chain.size()) ? chain[i + 1]->resume
+                                                   : c.loc))
+            {
+                return false;
+            }
+        }
+
+        base_type::setg(nullptr, nullptr, nullptr);
+        area_offset_ = c.output;
+        history_.clear();
+        return true;
+    }
+
+    // Opens |name| relative to |dir|, limited to |range|, and pushes a frame
+    // for it.  Includes in the new frame are relative to the directory |name|
+    // is in.  A name with wildcards in its last component stands for all the
+    // files it matches, in sorted order.  With |arguments| the file is an
+    // instance of a template.
+    bool open_included_stream(const std::shared_ptr< const directory > &dir,
+                              const std::string &name,
+                              const include_range &range,
+                              const std::string &arguments)
+    {
+        std::unique_ptr< base_type > source;
+
+        if (is_pattern(name))
+        {
+            source = open_matches(dir, name);
+        }
+        else if (!arguments.empty())
+        {
+            source = instantiate(dir, name, arguments);
+        }
+        else
+        {
+            std::unique_ptr< std::streambuf > bytes =
+                resolver_->open(*dir, name);
+
+            if (bytes)
+            {
+                source = preparer_traits_type::prepare(std::move(bytes));
+            }
+        }
+
+        if (!source)
+        {
+            return false;
+        }
+
+        if (range.unit != include_range::all)
+        {
+            source = slice(std::move(source), dir, name, arguments, range);
+
+            if (!source)
+            {
+                return false;
+            }
+        }
+
+        const std::string::size_type slash = name.rfind('/');
+        std::unique_ptr< frame > f(new frame(
+            source.get(),
+            (slash != std::string::npos) ? dir->subdirectory(
+                                               name.substr(0, slash + 1))
+                                         : dir));
+        f->owned = std::move(source);
+        check_plain(*f);
+        frames_.push_back(std::move(f));
+        return true;
+    }
+
+    // Finds out whether the memory source of |f| holds no directives at all,
+    // so that it can be served in one piece.  The answer is kept in the
+    // content cache for memory with an owner, which tells it apart from any
+    // other memory for as long as it is alive, so streams sharing the cache
+    // check the same memory only once whichever resolver it came from.
+    void check_plain(frame &f)
+    {
+        if (!f.memory)
+        {
+            return;
+        }
+
+        const char_type *data = f.memory->data();
+        const std::size_t size = f.memory->size();
+        const std::shared_ptr< const void > &owner = f.memory->owner();
+        std::string key;
+
+        if (owner)
+        {
+            key = typeid(include_spec_type).name();
+            key += '\0';
+            key += std::to_string(reinterpret_cast< std::uintptr_t >(data));
+            key += ':';
+            key += std::to_string(size);
+
+            if (content_cache_->find_plain(key, owner, f.plain))
+            {
+                return;
+            }
+        }
+
+        f.plain = !spec_traits_type::may_hold_directive(data, data + size);
+
+        if (owner)
+        {
+            content_cache_->insert_plain(key, owner, f.plain);
+        }
+    }
+
+    // Finds out whether the complete lines of the block just read into |f|
+    // hold no directives, so that they can be served in one piece.
+    void check_plain_lines(frame &f)
+    {
+        const char_type *end = f.data + f.size;
+
+        while (end != f.data && !traits_type::eq(*(end - 1), newline()))
+        {
+            --end;
+        }
+
+        f.plain_end =
+            (end != f.data && !spec_traits_type::may_hold_directive(f.data, end))
+                ? end - f.data
+                : 0;
+    }
+
+    // Returns the template |name| with |arguments| filled in.  The template
+    // is decoded by the preparer first, so it can be in any encoding the
+    // stream reads, and the values are decoded from UTF-8 to match.  An
+    // instance is only rendered once for all the streams that share the
+    // content cache and the resolver; after that the template is not even
+    // opened.
+    std::unique_ptr< base_type > instantiate(
+        const std::shared_ptr< const directory > &dir,
+        const std::string &name,
+        const std::string &arguments)
+    {
+        std::string key = typeid(string_type).name();
+        key += '\0';
+        key += typeid(stream_preparer_type).name();
+        key += '\0';
+        key += std::to_string(
+            reinterpret_cast< std::uintptr_t >(resolver_.get()));
+        key += '\0';
+        key += normalize_path((name[0] == '/') ? name : dir->path() + name);
+        key += '\0';
+        key += arguments;
+
+        std::shared_ptr< const string_type > rendered =
+            content_cache_->find< string_type >(key, resolver_);
+
+        if (!rendered)
+        {
+            std::unique_ptr< std::streambuf > bytes =
+                resolver_->open(*dir, name);
+            std::unique_ptr< base_type > source =
+                bytes ? preparer_traits_type::prepare(std::move(bytes))
+                      : nullptr;
+
+            if (!source)
+            {
+                return nullptr;
+            }
+
+            std::vector< std::pair< string_type, string_type > > values;
+
+            for (const variable &a : parse_arguments(arguments))
+            {
+                values.emplace_back(
+                    utf8_widen< char_type, traits_type >(a.first),
+                    utf8_widen< char_type, traits_type >(a.second));
+            }
+
+            rendered = content_cache_->insert(
+                key,
+                resolver_,
+                std::make_shared< const string_type >(
+                    render_template(read_contents(*source), values)));
+        }
+
+        return std::unique_ptr< base_type >(new memory_streambuf_type(
+            rendered->data(), rendered->size(), rendered));
+    }
+
+    static string_type read_contents(base_type &source)
+    {
+        memory_streambuf_type *memory =
+            dynamic_cast< memory_streambuf_type * >(&source);
+
+        if (memory)
+        {
+            return string_type(memory->data(), memory->size());
+        }
+
+        string_type contents;
+        std::streamsize n = 0;
+
+        do
+        {
+            const std::size_t size = contents.size();
+            contents.resize(size + block_size());
+            n = source.sgetn(&contents[size], block_size());
+            contents.resize(size + std::max< std::streamsize >(n, 0));
+        } while (n > 0);
+
+        return contents;
+    }
+
+    // Reads arguments such as "shard=3 region=eu" sorted by name.  The last
+    // of repeated names wins.
+    static std::vector< variable > parse_arguments(const std::string &text)
+    {
+        std::vector< variable > arguments;
+        std::string::size_type pos = 0;
+
+        while ((pos = text.find_first_not_of(" \t", pos)) != std::string::npos)
+        {
+            std::string::size_type end = text.find_first_of(" \t", pos);
+            end = (end == std::string::npos) ? text.size() : end;
+
+            const std::string::size_type eq = text.find('=', pos);
+
+            if (eq < end)
+            {
+                arguments.push_back(
+                    variable(text.substr(pos, eq - pos),
+                             text.substr(eq + 1, end - eq - 1)));
+            }
+
+            pos = end;
+        }
+
+        std::stable_sort(arguments.begin(),
+                         arguments.end(),
+                         [](const variable &a, const variable &b) {
+                             return a.first < b.first;
+                         });
+
+        std::vector< variable > unique;
+
+        for (std::size_t i = 0; i < arguments.size(); ++i)
+        {
+            if (i + 1 == arguments.size() ||
+                arguments[i].first != arguments[i + 1].first)
+            {
+                unique.push_back(arguments[i]);
+            }
+        }
+
+        return unique;
+    }
+
+    // The same arguments always written the same way, so that they can be
+    // told apart by comparing strings.
+    static std::string canonical_arguments(const std::string &text)
+    {
+        std::string canonical;
+
+        for (const variable &a : parse_arguments(text))
+        {
+            canonical += (canonical.empty() ? "" : " ") + a.first + "=" +
+                         a.second;
+        }
+
+        return canonical;
+    }
+
+    static bool is_pattern(const std::string &name)
+    {
+        const std::string::size_type slash = name.rfind('/');
+
+        return name.find_first_of(
+                   "*?[", (slash == std::string::npos) ? 0 : slash + 1) !=
+               std::string::npos;
+    }
+
+    // Opens the files matching the wildcard |pattern| as one source, or
+    // returns nullptr if there are none.
+    std::unique_ptr< base_type > open_matches(
+        const std::shared_ptr< const directory > &dir,
+        const std::string &pattern)
+    {
+        const std::string::size_type slash = pattern.rfind('/');
+        const std::string path =
+            (slash == std::string::npos) ? "" : pattern.substr(0, slash + 1);
+        const std::string file_pattern = pattern.substr(path.size());
+
+        std::vector< std::string > names;
+
+        for (const std::string &entry : listing(dir, path))
+        {
+            if (::fnmatch(file_pattern.c_str(), entry.c_str(), FNM_PERIOD) ==
+                0)
+            {
+                names.push_back(path + entry);
+            }
+        }
+
+        if (names.empty())
+        {
+            return nullptr;
+        }
+
+        return std::unique_ptr< base_type >(new prefetch_streambuf_type(
+            resolver_,
+            dir,
+            std::move(names),
+            [](std::unique_ptr< std::streambuf > bytes) {
+                return preparer_traits_type::prepare(std::move(bytes));
+            }));
+    }
+
+    // The sorted names of the files in |path| relative to |dir|.  Listings
+    // are kept for as long as the resolver is, so a directory is usually
+    // only listed once however often it is included from.
+    const std::vector< std::string > &listing(
+        const std::shared_ptr< const directory > &dir, const std::string &path)
+    {
+        const lookup_key key(dir, path);
+        typename listing_map::iterator it = listings_.find(key);
+
+        if (it == listings_.end())
+        {
+            std::vector< std::string > names = resolver_->list(*dir, path);
+            std::sort(names.begin(), names.end());
+            make_room(listings_);
+            it = listings_.emplace(key, std::move(names)).first;
+        }
+
+        return it->second;
+    }
+
+    // Limits |source| to |range|.  Line ranges are found through an index of
+    // the file, or of the instance of a template with |arguments|, kept for
+    // as long as the resolver is, and memory sources stay views of the same
+    // memory.
+    std::unique_ptr< base_type > slice(
+        std::unique_ptr< base_type > source,
+        const std::shared_ptr< const directory > &dir,
+        const std::string &name,
+        const std::string &arguments,
+        const include_range &range)
+    {
+        const off_type unbounded = std::numeric_limits< off_type >::max();
+        off_type begin = range.first;
+        off_type end = (range.last == include_range::open_end())
+                           ? unbounded
+                           : off_type(range.last) + 1;
+
+        if (range.unit == include_range::lines)
+        {
+            make_room(line_indexes_);
+            line_index_type &index = line_indexes_[lookup_key(
+                dir, arguments.empty() ? name : name + '\0' + arguments)];
+
+            begin = index.find(*source, range.first);
+            end = (end == unbounded) ? end : index.find(*source, end);
+
+            if (begin < 0 || end < 0)
+            {
+                return nullptr;
+            }
+        }
+
+        memory_streambuf_type *memory =
+            dynamic_cast< memory_streambuf_type * >(source.get());
+
+        if (memory)
+        {
+            const off_type size = memory->size();
+            const char_type *data = memory->data() + std::min(begin, size);
+            const std::size_t count =
+                std::max< off_type >(std::min(end, size) - begin, 0);
+
+            return std::unique_ptr< base_type >(new memory_streambuf_type(
+                data, count, std::shared_ptr< const void >(std::move(source))));
+        }
+
+        return std::unique_ptr< base_type >(
+            new slice_streambuf_type(std::move(source), begin, end));
+    }
+
+    // Reads a range such as "lines 10-20" or "bytes 0-" into |range|.  Ranges
+    // that are empty or reach past the largest offset are rejected.
+    static bool parse_range(const std::string &text, include_range &range)
+    {
+        const std::string::size_type space = text.find_first_of(" \t");
+        const std::string::size_type number =
+            text.find_first_not_of(" \t", space);
+
+        if (number == std::string::npos)
+        {
+            return false;
+        }
+
+        const std::string unit = text.substr(0, space);
+
+        if (unit == "lines")
+        {
+            range.unit = include_range::lines;
+        }
+        else if (unit == "bytes")
+        {
+            range.unit = include_range::bytes;
+        }
+        else
+        {
+            return false;
+        }
+
+        const char *p = text.c_str() + number;
+
+        if (!parse_number(p, range.first) || *p != '-')
+        {
+            return false;
+        }
+
+        range.last = include_range::open_end();
+
+        if (*(++p) && (!parse_number(p, range.last) || *p))
+        {
+            return false;
+        }
+
+        return range.first <= range.last &&
+               (range.unit == include_range::bytes || range.first > 0);
+    }
+
+    // Reads the decimal number at |p| into |value| and moves |p| past it.
+    // Numbers that do not fit an offset with room for one past the end are
+    // rejected.
+    static bool parse_number(const char *&p, std::size_t &value)
+    {
+        const std::size_t max = static_cast< std::size_t >(
+            std::min< unsigned long long >(
+                std::numeric_limits< off_type >::max() - 1,
+                include_range::open_end() - 1));
+
+        if (*p < '0' || *p > '9')
+        {
+            return false;
+        }
+
+        for (value = 0; *p >= '0' && *p <= '9'; ++p)
+        {
+            const std::size_t digit = *p - '0';
+
+            if (value > (max - digit) / 10)
+            {
+                return false;
+            }
+
+            value = value * 10 + digit;
+        }
+
+        return true;
+    }
+
+    bool check_for_include(frame &f)
+    {
+        const char_type *eol = traits_type::find(
+            f.data + f.pos, std::min(f.size - f.pos, lookahead_), newline());
+
+        while (!eol && f.size - f.pos < lookahead_)
+        {
+            const std::size_t searched = f.size - f.pos;
+
+            if (!read_block(f, true))
+            {
+                break;
+            }
+
+            eol = traits_type::find(
+                f.data + f.pos + searched,
+                std::min(f.size - f.pos, lookahead_) - searched,
+                newline());
+        }
+
+        const char_type *end =
+            eol ? eol : f.data + f.pos + std::min(f.size - f.pos, lookahead_);
+        directive_type directive;
+
+        if (!spec_traits_type::match(
+                f.data + f.pos,
+                end,
+                directive,
+                [this](const char_type *key,
+                       const char_type *key_end,
+                       const char_type *value,
+                       const char_type *value_end) {
+                    return condition_holds(key, key_end, value, value_end);
+                }))
+        {
+            return false;
+        }
+
+        f.pos = directive.discard ? (end - f.data) : (directive.end - f.data);
+        // the line goes on past the lookahead and is dropped as it is read
+        f.discard_line = directive.discard && !eol;
+        f.blank_line = false;
+
+        if (directive.excluded)
+        {
+            return true;
+        }
+
+        std::shared_ptr< frame_node > node = std::make_shared< frame_node >();
+        node->parent = f.node;
+        node->file_name = directive.file_name;
+        node->arguments = canonical_arguments(directive.arguments);
+        node->resume = f.at(f.pos);
+
+        if (!directive.range.empty() &&
+            !parse_range(directive.range, node->range))
+        {
+            throw std::ios_base::failure("includize: invalid range \"" +
+                                         directive.range + "\"");
+        }
+
+        // a file that cannot be opened is dropped with its directive
+        if (open_include(f.dir,
+                         node->file_name,
+                         node->range,
+                         node->arguments,
+                         node->dir))
+        {
+            frames_.back()->node = node;
+            add_checkpoint();
+        }
+
+        return true;
+    }
+
+    // Whether the variable [key, key_end) is defined, and if |value| is not
+    // nullptr, whether it is [value, value_end).  This is decided for every
+    // conditional directive before its file is opened, so it does not
+    // allocate.
+    bool condition_holds(const char_type *key,
+                         const char_type *key_end,
+                         const char_type *value,
+                         const char_type *value_end) const
+    {
+        // the grammar only allows ASCII names
+        char name[256];
+        const std::size_t size = key_end - key;
+
+        if (size >= sizeof(name))
+        {
+            return false;
+        }
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            name[i] = static_cast< char >(key[i]);
+        }
+
+        name[size] = '\0';
+
+        typename std::vector< variable >::const_iterator it = std::lower_bound(
+            variables_.begin(),
+            variables_.end(),
+            name,
+            [](const variable &v, const char *n) {
+                return v.first.compare(n) < 0;
+            });
+
+        const char *defined = nullptr;
+        std::size_t defined_size = 0;
+
+        if (it != variables_.end() && it->first.compare(name) == 0)
+        {
+            defined = it->second.data();
+            defined_size = it->second.size();
+        }
+        else if ((defined = std::getenv(name)))
+        {
+            defined_size = std::strlen(defined);
+        }
+
+        if (!defined || !value)
+        {
+            return defined != nullptr;
+        }
+
+        const string_type wide = utf8_widen< char_type, traits_type >(
+            std::string(defined, defined_size));
+
+        return static_cast< std::size_t >(value_end - value) == wide.size() &&
+               traits_type::compare(value, wide.data(), wide.size()) == 0;
+    }
+
+    // Opens |name| as included from |dir|.  A relative name is looked for in
+    // |dir| and then in each include path, and where it was found, or that it
+    // was not found at all, is remembered so that including it again costs a
+    // single lookup rather than a series of failed opens.  |found| is set to
+    // the directory |name| was opened relative to.
+    bool open_include(const std::shared_ptr< const directory > &dir,
+                      const std::string &name,
+                      const include_range &range,
+                      const std::string &arguments,
+                      std::shared_ptr< const directory > &found)
+    {
+        if (name.empty())
+        {
+            return false;
+        }
+
+        if (name[0] == '/')
+        {
+            found = dir;
+            return open_included_stream(found, name, range, arguments);
+        }
+
+        const lookup_key key(dir, name);
+        typename lookup_map::const_iterator it = lookups_.find(key);
+
+        if (it != lookups_.end())
+        {
+            if (it->second == not_found())
+            {
+                return false;
+            }
+
+            found = search_directory(dir, it->second);
+            return open_included_stream(found, name, range, arguments);
+        }
+
+        for (std::size_t i = 0; i <= include_paths_.size(); ++i)
+        {
+            found = search_directory(dir, i);
+
+            if (open_included_stream(found, name, range, arguments))
+            {
+                make_room(lookups_);
+                lookups_[key] = i;
+                return true;
+            }
+        }
+
+        make_room(lookups_);
+        lookups_[key] = not_found();
+        return false;
+    }
+
+    static constexpr std::size_t not_found() { return std::size_t(-1); }
+
+    // The number of entries kept in each of the maps below.  Their keys hold
+    // on to directories and so to their descriptors, so a stream that
+    // includes from very many directories starts over rather than keeping
+    // them all open.
+    static constexpr std::size_t max_remembered() { return 1024; }
+
+    template < typename MAP >
+    static void make_room(MAP &map)
+    {
+        if (map.size() >= max_remembered())
+        {
+            map.clear();
+        }
+    }
+
+    const std::shared_ptr< const directory > &search_directory(
+        const std::shared_ptr< const directory > &dir, std::size_t i) const
+    {
+        return i ? include_paths_[i - 1] : dir;
+    }
+
+    using lookup_key =
+        std::pair< std::shared_ptr< const directory >, std::string >;
+
+    struct lookup_hash
+    {
+        std::size_t operator()(const lookup_key &key) const
+        {
+            return std::hash< const directory * >()(key.first.get()) ^
+                   std::hash< std::string >()(key.second);
+        }
+    };
+
+    using lookup_map =
+        std::unordered_map< lookup_key, std::size_t, lookup_hash >;
+    using line_index_map =
+        std::unordered_map< lookup_key, line_index_type, lookup_hash >;
+    using listing_map = std::unordered_map< lookup_key,
+                                            std::vector< std::string >,
+                                            lookup_hash >;
+
 private:
-    istream_type &stream_;
-    ifstream_type *included_file_;
-    basic_streambuf *included_file_pp_;
-    istream_type *included_stream_;
-    string_type included_buffer_;
-    string_type buffer_;
-    std::string path_;
+    std::shared_ptr< resolver > resolver_;
+    std::shared_ptr< content_cache > content_cache_;
+    std::vector< std::shared_ptr< const directory > > include_paths_;
+    lookup_map lookups_;
+    line_index_map line_indexes_;
+    listing_map listings_;
+    // sorted by name
+    std::vector< variable > variables_;
+    std::unique_ptr< variable_table_type > variable_table_;
+    std::unique_ptr< char_set< char_type > > stops_;
+    std::string root_file_name_;
+    std::shared_ptr< const directory > root_directory_;
+    std::vector< std::unique_ptr< frame > > frames_;
+    std::vector< checkpoint > checkpoints_;
+    // the least output between checkpoints, once there have been too many
+    off_type checkpoint_spacing_;
+    string_type history_;
+    std::unique_ptr< char_type[] > putback_;
+    char_type *suspended_eback_;
+    char_type *suspended_gptr_;
+    char_type *suspended_egptr_;
+    bool putback_mode_;
+    off_type area_offset_;
+    // whether |variables_| changed since |variable_table_| was built
+    bool variables_changed_;
+    bool substitution_;
+    bool normalize_line_endings_;
+    std::size_t lookahead_;
 };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -48,17 +48,26 @@ struct toml_spec< char >
     static constexpr char header_start() { return '#'; }
     static constexpr const char *regex()
     {
-        return R"..(\s*\[\[include\s*"(([^"]|\")+)"\s*]])..";
+        return R"..(\s*\[\[include).."
+               R"..((?:_(if|unless)\s+([A-Za-z_][\w.]*)(?:=([^\s"\]]*))?)?).."
+               R"..(\s*"(([^"]|\")+)").."
+               R"..((?:\s+((lines|bytes)\s+\d+-\d*))?).."
+               R"..((?:\s+with((?:\s+[A-Za-z_][\w.]*=[^\s"\]]*)+))?).."
+               R"..(\s*]])..";
     }
 
-    static constexpr std::size_t file_name_index() { return 1; };
+    static constexpr const char *literal() { return "[[include"; }
+    static constexpr std::size_t file_name_index() { return 4; };
+    static constexpr std::size_t range_index() { return 6; }
+    static constexpr std::size_t condition_index() { return 1; }
+    static constexpr std::size_t arguments_index() { return 8; }
     static constexpr bool discard_characters_after_include() { return true; }
 
     static std::string convert_filename(const std::string &str) { return str; }
 
     static std::string unescape_filename(const std::string &str)
     {
-        return std::regex_replace(str, std::regex("\\\\\""), "\"");
+        return unescape_quotes(str);
     }
 };
 
@@ -43,6 +43,24 @@
 // Obviously if this is not good enough for a use case, another specification
 // can be used.  Additionally it will remove any trailing text on that
 // particular line for no reason other than I like it that way.
+//
+// Only part of a file can be included by following the file name with a
+// range of lines, counted from 1, or of bytes, counted from 0, either of which
+// may be left open at the end:
+//
+//     [[ #includize "path/to/some/file.inc" lines 10-20 ]]
+//     [[ #includize "path/to/some/file.inc" bytes 4096- ]]
+//
+// A file can also be included only if a variable, defined on the stream or
+// in the environment, is set, or set to a given value, or only if it is not:
+//
+//     [[ #includize_if REGION=eu "regions/eu.inc" ]]
+//     [[ #includize_unless REGION "regions/default.inc" ]]
+//
+// Arguments make the included file a template whose ${NAME}s are replaced
+// with the values given:
+//
+//     [[ #includize "shard.inc" with shard=3 region=eu ]]
 
 namespace includize
 {
@@ -57,10 +75,19 @@ struct universal_spec< char >
     static constexpr char header_start() { return '['; }
     static constexpr const char *regex()
     {
-        return R"..(\[\s*#includize\s*"(([^"]|\")+)"\s*]])..";
+        return R"..(\[\s*#includize).."
+               R"..((?:_(if|unless)\s+([A-Za-z_][\w.]*)(?:=([^\s"\]]*))?)?).."
+               R"..(\s*"(([^"]|\")+)").."
+               R"..((?:\s+((lines|bytes)\s+\d+-\d*))?).."
+               R"..((?:\s+with((?:\s+[A-Za-z_][\w.]*=[^\s"\]]*)+))?).."
+               R"..(\s*]])..";
     }
 
-    static constexpr std::size_t file_name_index() { return 1; };
+    static constexpr const char *literal() { return "#includize"; }
+    static constexpr std::size_t file_name_index() { return 4; };
+    static constexpr std::size_t range_index() { return 6; }
+    static constexpr std::size_t condition_index() { return 1; }
+    static constexpr std::size_t arguments_index() { return 8; }
 
     static constexpr bool discard_characters_after_include() { return true; }
 
@@ -68,7 +95,7 @@ struct universal_spec< char >
 
     static std::string unescape_filename(const std::string &str)
     {
-        return std::regex_replace(str, std::regex("\\\\\""), "\"");
+        return unescape_quotes(str);
     }
 };
 
@@ -0,0 +1,247 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDIZE_VARIABLE_TABLE_HPP
+#define INCLUDIZE_VARIABLE_TABLE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "multibyte/utf8.hpp"
+
+namespace includize
+{
+// Maps variable names to values with a perfect hash, so looking a name up
+// takes two hashes of it and a single comparison however many variables
+// there are.  Names are found straight from the characters of the stream,
+// without making a string of them.
+template < typename CHAR_T, typename TRAITS = std::char_traits< CHAR_T > >
+class basic_variable_table
+{
+public:
+    using char_type = CHAR_T;
+    using traits_type = TRAITS;
+    using string_type = std::basic_string< char_type, traits_type >;
+    using variable = std::pair< std::string, std::string >;
+
+public:
+    basic_variable_table() {}
+
+    // Builds the table of |variables|, whose names must be distinct.  Names
+    // and values are UTF-8, and are decoded for wider character types.
+    explicit basic_variable_table(const std::vector< variable > &variables)
+    {
+        std::vector< entry > entries;
+
+        for (const variable &v : variables)
+        {
+            entries.push_back(
+                entry{utf8_widen< char_type, traits_type >(v.first),
+                      utf8_widen< char_type, traits_type >(v.second)});
+        }
+
+        if (entries.empty())
+        {
+            return;
+        }
+
+        // hash and displace: every bucket of names gets a seed that sends
+        // all of its names to free slots, the biggest buckets first
+        std::size_t slots = 1;
+
+        while (slots < 2 * entries.size())
+        {
+            slots *= 2;
+        }
+
+        while (!place(entries, slots))
+        {
+            slots *= 2;
+        }
+    }
+
+    // The value of the variable [name, name_end), or nullptr if there is
+    // none.
+    const string_type *find(const char_type *name,
+                            const char_type *name_end) const
+    {
+        if (slots_.empty())
+        {
+            return nullptr;
+        }
+
+        const std::uint32_t seed =
+            seeds_[hash(name, name_end, 0) & (seeds_.size() - 1)];
+        const entry &e =
+            slots_[hash(name, name_end, seed) & (slots_.size() - 1)];
+        const std::size_t size = name_end - name;
+
+        if (e.name.size() != size ||
+            traits_type::compare(e.name.data(), name, size) != 0)
+        {
+            return nullptr;
+        }
+
+        return &e.value;
+    }
+
+private:
+    struct entry
+    {
+        string_type name;
+        string_type value;
+    };
+
+    static constexpr std::uint32_t max_seed() { return 4096; }
+
+    static std::uint32_t hash(const char_type *begin,
+                              const char_type *end,
+                              std::uint32_t seed)
+    {
+        std::uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+        for (; begin < end; ++begin)
+        {
+            h ^= static_cast< std::uint32_t >(traits_type::to_int_type(*begin));
+            h *= 16777619u;
+        }
+
+        return h ^ (h >> 15);
+    }
+
+    bool place(std::vector< entry > &entries, std::size_t slots)
+    {
+        std::size_t bucket_count = 1;
+
+        while (bucket_count < entries.size() / 2)
+        {
+            bucket_count *= 2;
+        }
+
+        std::vector< std::vector< std::size_t > > buckets(bucket_count);
+
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            const string_type &name = entries[i].name;
+            buckets[hash(name.data(), name.data() + name.size(), 0) &
+                    (bucket_count - 1)]
+                .push_back(i);
+        }
+
+        std::vector< std::size_t > order(bucket_count);
+
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            order[i] = i;
+        }
+
+        std::stable_sort(
+            order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+                return buckets[a].size() > buckets[b].size();
+            });
+
+        std::vector< std::uint32_t > seeds(bucket_count, 0);
+        std::vector< bool > taken(slots, false);
+        std::vector< std::size_t > chosen;
+
+        for (std::size_t b : order)
+        {
+            if (buckets[b].empty())
+            {
+                break;
+            }
+
+            std::uint32_t seed = 1;
+
+            for (; seed < max_seed(); ++seed)
+            {
+                chosen.clear();
+
+                for (std::size_t i : buckets[b])
+                {
+                    const string_type &name = entries[i].name;
+                    const std::size_t slot =
+                        hash(name.data(), name.data() + name.size(), seed) &
+                        (slots - 1);
+
+                    if (taken[slot] || std::find(chosen.begin(),
+                                                 chosen.end(),
+                                                 slot) != chosen.end())
+                    {
+                        break;
+                    }
+
+                    chosen.push_back(slot);
+                }
+
+                if (chosen.size() == buckets[b].size())
+                {
+                    break;
+                }
+            }
+
+            if (seed == max_seed())
+            {
+                return false;
+            }
+
+            seeds[b] = seed;
+
+            for (std::size_t slot : chosen)
+            {
+                taken[slot] = true;
+            }
+        }
+
+        slots_.assign(slots, entry());
+
+        for (std::size_t b = 0; b < bucket_count; ++b)
+        {
+            for (std::size_t i : buckets[b])
+            {
+                const string_type &name = entries[i].name;
+                slots_[hash(name.data(), name.data() + name.size(), seeds[b]) &
+                       (slots - 1)] = entries[i];
+            }
+        }
+
+        seeds_ = std::move(seeds);
+        return true;
+    }
+
+    std::vector< std::uint32_t > seeds_;
+    std::vector< entry > slots_;
+};
+}
+
+#endif
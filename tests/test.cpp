@@ -33,15 +33,28 @@
 #include "catch.hpp"
 #include "cpptoml.h"
 
+#include "../include/includize/bundle.hpp"
+#include "../include/includize/decompress.hpp"
 #include "../include/includize/includize.hpp"
+#include "../include/includize/line_anchored_spec.hpp"
+#include "../include/includize/multi_spec.hpp"
+#include "../include/includize/multibyte/auto_preparer.hpp"
+#include "../include/includize/multibyte/utf8_preparer.hpp"
+#include "../include/includize/multibyte/utoml.hpp"
+#include "../include/includize/multibyte/uuniversal.hpp"
 #include "../include/includize/multibyte/wstream_preparer.hpp"
 #include "../include/includize/multibyte/wtoml.hpp"
 #include "../include/includize/multibyte/wuniversal.hpp"
+#include "../include/includize/resolver.hpp"
 
+#include <algorithm>
 #include <codecvt>
+#include <cstring>
 #include <fstream>
 #include <memory>
 #include <sstream>
+#include <unistd.h>
+#include <vector>
 
 std::string convert(const std::wstring &str)
 {
@@ -188,4 +201,1707 @@ TEST_CASE("universal", "[universal]")
         REQUIRE(without_includes.str() != "");
         REQUIRE(with_includes.str() == without_includes.str());
     }
-}
\ No newline at end of file
+}
+
+template < typename CHAR_T >
+std::basic_string< CHAR_T > read_all(std::basic_istream< CHAR_T > &s)
+{
+    std::basic_ostringstream< CHAR_T > out;
+    out << s.rdbuf();
+    return out.str();
+}
+
+// Serves the files of a memory_resolver through streams that are not in
+// memory, as the filesystem does.
+class streaming_resolver : public includize::memory_resolver
+{
+public:
+    using includize::memory_resolver::open;
+
+    std::unique_ptr< std::streambuf > open(const std::string &name) override
+    {
+        std::unique_ptr< std::streambuf > memory =
+            includize::memory_resolver::open(name);
+
+        if (!memory)
+        {
+            return nullptr;
+        }
+
+        std::ostringstream contents;
+        contents << memory.get();
+        return std::unique_ptr< std::streambuf >(
+            new std::stringbuf(contents.str()));
+    }
+};
+
+TEST_CASE("seek", "[streambuf]")
+{
+    SECTION("char")
+    {
+        using preprocessor_type = includize::universal_preprocessor;
+
+        preprocessor_type pp("tests/base.txt");
+        const std::string expanded = read_all(pp.stream());
+
+        std::ifstream included_infile("tests/included.txt");
+        const std::string included = read_all< char >(included_infile);
+        const std::size_t first = expanded.find(included);
+
+        REQUIRE(first != std::string::npos);
+
+        const std::size_t last = first + included.size();
+
+        for (std::size_t pos : {std::size_t(0),
+                                std::size_t(1),
+                                first - 1,
+                                first,
+                                first + 1,
+                                last - 1,
+                                last,
+                                expanded.size() - 1})
+        {
+            pp.stream().clear();
+            pp.stream().seekg(pos);
+            REQUIRE(pp.stream().tellg() == std::streampos(pos));
+            REQUIRE(read_all(pp.stream()) == expanded.substr(pos));
+        }
+
+        pp.stream().clear();
+        pp.stream().seekg(0, std::ios::end);
+        REQUIRE(pp.stream().tellg() == std::streampos(expanded.size()));
+    }
+
+    SECTION("wchar_t")
+    {
+        using preprocessor_type = includize::basic_preprocessor<
+            includize::toml_spec< wchar_t >,
+            wchar_t,
+            std::char_traits< wchar_t >,
+            includize::wstream_utf16_header_preparer >;
+
+        preprocessor_type pp("tests/wbase.toml");
+        const std::wstring expanded = read_all(pp.stream());
+
+        for (std::size_t pos : {std::size_t(3), std::size_t(450)})
+        {
+            pp.stream().clear();
+            pp.stream().seekg(pos);
+            REQUIRE(read_all(pp.stream()) == expanded.substr(pos));
+        }
+    }
+
+    SECTION("blocks")
+    {
+        // both files span several blocks, so seeking back resumes from
+        // checkpoints in the middle of either of them
+        const auto lines = [](const std::string &key, std::size_t count) {
+            std::string text;
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                text += key + std::to_string(i) + " = " + std::to_string(i) +
+                        "\n";
+            }
+
+            return text;
+        };
+
+        const std::string before = lines("a", 1000);
+        const std::string part = lines("b", 2000);
+        const std::string after = lines("c", 1000);
+
+        std::shared_ptr< streaming_resolver > files =
+            std::make_shared< streaming_resolver >();
+        files->add("base.toml",
+                   before + "# [[include \"part.toml\"]]\n" + after);
+        files->add("part.toml", part);
+
+        includize::toml_preprocessor pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        const std::string expected = before + part + "\n" + after;
+        const std::size_t block = 8192;
+        const std::size_t first = before.size();
+        const std::size_t last = first + part.size();
+
+        REQUIRE(first > block);
+        REQUIRE(part.size() > 2 * block);
+        REQUIRE(read_all(pp.stream()) == expected);
+
+        std::vector< std::size_t > positions = {expected.size() - 1,
+                                                last + 1,
+                                                last,
+                                                first + 2 * block + 1,
+                                                first + block,
+                                                first + 1,
+                                                first,
+                                                block + 1,
+                                                block,
+                                                block - 1,
+                                                0};
+
+        for (int i = 0; i < 2; ++i)
+        {
+            for (std::size_t pos : positions)
+            {
+                pp.stream().clear();
+                REQUIRE(pp.stream().seekg(pos));
+                REQUIRE(pp.stream().tellg() == std::streampos(pos));
+                REQUIRE(read_all(pp.stream()) == expected.substr(pos));
+            }
+
+            std::reverse(positions.begin(), positions.end());
+        }
+    }
+
+    SECTION("many checkpoints")
+    {
+        // every include starts and ends a run, so there are more of them
+        // than checkpoints are kept for, and some are dropped
+        std::shared_ptr< includize::memory_resolver > files =
+            std::make_shared< includize::memory_resolver >();
+        std::string base;
+        std::string expected;
+
+        for (int i = 0; i < 5000; ++i)
+        {
+            base += "a" + std::to_string(i) + " = 1\n"
+                    "#[[include \"part.toml\"]]\n";
+            expected += "a" + std::to_string(i) + " = 1\nb = 2\n\n";
+        }
+
+        files->add("base.toml", base);
+        files->add("part.toml", "b = 2\n");
+
+        includize::toml_preprocessor pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        REQUIRE(read_all(pp.stream()) == expected);
+
+        for (std::size_t pos : {expected.size() - 1,
+                                expected.size() / 2 + 3,
+                                std::size_t(70001),
+                                std::size_t(5),
+                                expected.size() - 5000})
+        {
+            pp.stream().clear();
+            REQUIRE(pp.stream().seekg(pos));
+            REQUIRE(read_all(pp.stream()) == expected.substr(pos));
+        }
+    }
+}
+
+TEST_CASE("missing files", "[streambuf]")
+{
+    std::shared_ptr< includize::memory_resolver > files =
+        std::make_shared< includize::memory_resolver >();
+    files->add("base.toml",
+               "a = 1\n# [[include \"missing.toml\"]]\nb = 2 # [[include "
+               "\"missing.toml\"]] c = 3\n");
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(files);
+
+    REQUIRE(read_all(pp.stream()) == "a = 1\n\nb = 2 \n");
+}
+
+TEST_CASE("putback", "[streambuf]")
+{
+    using preprocessor_type = includize::universal_preprocessor;
+
+    preprocessor_type pp("tests/base.txt");
+    const std::string expanded = read_all(pp.stream());
+
+    pp.stream().clear();
+    pp.stream().seekg(0);
+
+    std::string unget_each;
+
+    for (int c = pp.stream().get(); c != EOF; c = pp.stream().get())
+    {
+        REQUIRE(pp.stream().unget());
+        REQUIRE(pp.stream().get() == c);
+        unget_each += static_cast< char >(c);
+    }
+
+    REQUIRE(unget_each == expanded);
+
+    // across the end of the included text, and with a different character
+    pp.stream().clear();
+    pp.stream().seekg(200);
+
+    char buf[20];
+    REQUIRE(pp.stream().read(buf, sizeof(buf)));
+
+    for (std::size_t i = sizeof(buf); i > 4; --i)
+    {
+        REQUIRE(pp.stream().unget());
+    }
+
+    REQUIRE(pp.stream().tellg() == std::streampos(204));
+    REQUIRE(pp.stream().putback('!'));
+    REQUIRE(pp.stream().get() == '!');
+    REQUIRE(read_all(pp.stream()) == expanded.substr(204));
+}
+
+TEST_CASE("bulk read", "[streambuf]")
+{
+    using preprocessor_type = includize::toml_preprocessor;
+
+    preprocessor_type pp("tests/base.toml");
+    const std::string expanded = read_all(pp.stream());
+
+    pp.stream().clear();
+    pp.stream().seekg(0);
+
+    std::vector< char > buf(expanded.size() + 10);
+    pp.stream().read(buf.data(), buf.size());
+
+    REQUIRE(pp.stream().gcount() == std::streamsize(expanded.size()));
+    REQUIRE(std::string(buf.data(), expanded.size()) == expanded);
+
+    pp.stream().clear();
+    pp.stream().seekg(0);
+    pp.stream().peek();
+
+    REQUIRE(pp.stream().rdbuf()->in_avail() > 0);
+    REQUIRE(pp.stream().readsome(buf.data(), buf.size()) > 0);
+    REQUIRE(std::string(buf.data(), pp.stream().gcount()) ==
+            expanded.substr(0, pp.stream().gcount()));
+}
+
+TEST_CASE("utf-16", "[multibyte]")
+{
+    std::wstring text;
+
+    for (int i = 0; i < 3000; ++i)
+    {
+        text += L"line \u00e9\u4e2d \U0001f600 " + std::to_wstring(i) + L"\n";
+    }
+
+    const auto encode = [&text](bool big_endian, bool bom) {
+        std::string bytes;
+
+        const auto put = [&bytes, big_endian](unsigned u) {
+            bytes += char(big_endian ? u >> 8 : u & 0xff);
+            bytes += char(big_endian ? u & 0xff : u >> 8);
+        };
+
+        if (bom)
+        {
+            put(0xfeff);
+        }
+
+        for (wchar_t c : text)
+        {
+            const unsigned long cp = c;
+
+            if (cp >= 0x10000)
+            {
+                put(0xd800 + ((cp - 0x10000) >> 10));
+                put(0xdc00 + ((cp - 0x10000) & 0x3ff));
+            }
+            else
+            {
+                put(cp);
+            }
+        }
+
+        return bytes;
+    };
+
+    const auto decode = [](const std::string &bytes,
+                           includize::utf16_byte_order order) {
+        std::unique_ptr< std::streambuf > source(new std::stringbuf(bytes));
+        includize::basic_utf16_streambuf< wchar_t > buf(std::move(source),
+                                                        order);
+        std::wistream in(&buf);
+        std::wstring first((std::istreambuf_iterator< wchar_t >(in)),
+                           std::istreambuf_iterator< wchar_t >());
+
+        in.clear();
+        REQUIRE(in.seekg(0));
+        std::wstring second((std::istreambuf_iterator< wchar_t >(in)),
+                            std::istreambuf_iterator< wchar_t >());
+        REQUIRE(first == second);
+        return first;
+    };
+
+    using order = includize::utf16_byte_order;
+
+    REQUIRE(decode(encode(true, true), order::detect) == text);
+    REQUIRE(decode(encode(false, true), order::detect) == text);
+    REQUIRE(decode(encode(true, false), order::detect) == text);
+    REQUIRE(decode(encode(true, false), order::big_endian) == text);
+    REQUIRE(decode(encode(false, false), order::little_endian) == text);
+
+    // A lone surrogate and a high surrogate cut off by the end of the input
+    std::string broken = encode(false, false).substr(0, 16);
+    broken += std::string("\x00\xdc\x41\x00\x00\xd8", 6);
+    REQUIRE(decode(broken, order::little_endian) ==
+            text.substr(0, 8) + L"\ufffdA\ufffd");
+}
+
+TEST_CASE("utf-8", "[multibyte]")
+{
+    std::string part;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        part += "clé = \"中文 \xf0\x9f\x98\x80 " + std::to_string(i) +
+                "\"\n";
+    }
+
+    std::shared_ptr< includize::memory_resolver > files =
+        std::make_shared< includize::memory_resolver >();
+
+    files->add("base.toml",
+               "\xef\xbb\xbf[tâble]\n"
+               "# [[include \"pärt.toml\"]]\n"
+               "[[ #includize \"pärt.toml\" lines 2-2 ]]\n"
+               "bad = \"\xc0\xaf\xed\xa0\x80\xe4\xb8\"\n");
+    files->add("pärt.toml", part);
+
+    using narrow_spec =
+        includize::multi_spec< includize::toml_spec< char >,
+                               includize::universal_spec< char > >;
+
+    includize::basic_preprocessor< narrow_spec, char > narrow("base.toml");
+    narrow.rdbuf().set_resolver(files);
+    const std::string expected = read_all(narrow.stream()).substr(3);
+
+    SECTION("char32_t")
+    {
+        using spec =
+            includize::multi_spec< includize::toml_spec< char32_t >,
+                                   includize::universal_spec< char32_t > >;
+
+        includize::basic_preprocessor<
+            spec,
+            char32_t,
+            std::char_traits< char32_t >,
+            includize::utf8_stream_preparer< char32_t > >
+            pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        std::wstring_convert< std::codecvt_utf8< char32_t >, char32_t >
+            converter;
+        const std::u32string expanded = read_all(pp.stream());
+
+        // the 7 invalid bytes of the last line decode to 6 replacements
+        REQUIRE(converter.to_bytes(expanded.substr(0, expanded.size() - 8)) ==
+                expected.substr(0, expected.size() - 9));
+        REQUIRE(expanded.substr(expanded.size() - 8) ==
+                U"\ufffd\ufffd\ufffd\ufffd\ufffd\ufffd\"\n");
+    }
+
+    SECTION("char16_t")
+    {
+        includize::basic_preprocessor<
+            includize::toml_spec< char16_t >,
+            char16_t,
+            std::char_traits< char16_t >,
+            includize::utf8_stream_preparer< char16_t > >
+            pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        std::wstring_convert< std::codecvt_utf8_utf16< char16_t >, char16_t >
+            converter;
+        const std::u16string expanded = read_all(pp.stream());
+        const std::u16string::size_type lines =
+            expanded.find(u"[[ #includize");
+
+        REQUIRE(lines != std::u16string::npos);
+        REQUIRE(converter.to_bytes(expanded.substr(0, lines)) ==
+                expected.substr(0, expected.find(part) + part.size() + 1));
+    }
+}
+
+TEST_CASE("utf-16 in place", "[multibyte]")
+{
+    std::u16string text;
+
+    for (int i = 0; i < 500; ++i)
+    {
+        text += u"cl\u00e9 = \"\u4e2d \U0001f600 \"\n";
+    }
+
+    const std::u16string base = u"# [[include \"part.toml\"]]\n";
+    std::string bytes = "\xff\xfe";
+
+    for (char16_t c : base + text)
+    {
+        bytes += char(c & 0xff);
+        bytes += char(c >> 8);
+    }
+
+    std::shared_ptr< includize::memory_resolver > files =
+        std::make_shared< includize::memory_resolver >();
+    files->add("base.toml", bytes.substr(0, 2 + 2 * base.size()));
+    files->add("part.toml", "\xff\xfe" + bytes.substr(2 + 2 * base.size()));
+
+    using preparer = includize::utf16_stream_preparer< char16_t >;
+
+    SECTION("served in place")
+    {
+        std::unique_ptr< std::streambuf > source = files->open("part.toml");
+        const char *data =
+            static_cast< includize::memory_streambuf & >(*source).data();
+        std::unique_ptr< std::basic_streambuf< char16_t > > chars =
+            preparer::prepare_streambuf(std::move(source));
+        includize::basic_memory_streambuf< char16_t > *memory = dynamic_cast<
+            includize::basic_memory_streambuf< char16_t > * >(chars.get());
+
+        REQUIRE(memory);
+        REQUIRE(static_cast< const void * >(memory->data()) == data + 2);
+        REQUIRE(std::u16string(memory->data(), memory->size()) == text);
+    }
+
+    SECTION("expanded")
+    {
+        includize::basic_preprocessor< includize::toml_spec< char16_t >,
+                                       char16_t,
+                                       std::char_traits< char16_t >,
+                                       preparer >
+            pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        REQUIRE(read_all(pp.stream()) == text + u"\n");
+    }
+
+    SECTION("decoded")
+    {
+        std::string swapped = bytes.substr(2);
+
+        for (std::size_t i = 0; i < swapped.size(); i += 2)
+        {
+            std::swap(swapped[i], swapped[i + 1]);
+        }
+
+        const std::string broken = bytes + std::string("\x3d\xd8\x41\x00", 4);
+
+        const auto decode = [](std::unique_ptr< std::streambuf > source,
+                               includize::utf16_byte_order order) {
+            std::unique_ptr< std::basic_streambuf< char16_t > > chars =
+                includize::prepare_utf16_streambuf< char16_t >(
+                    std::move(source), order);
+            REQUIRE(!dynamic_cast<
+                    includize::basic_memory_streambuf< char16_t > * >(
+                chars.get()));
+
+            std::basic_istream< char16_t > in(chars.get());
+            return read_all(in);
+        };
+
+        REQUIRE(decode(std::unique_ptr< std::streambuf >(
+                           new std::stringbuf(swapped)),
+                       includize::utf16_byte_order::detect) == base + text);
+        REQUIRE(decode(std::unique_ptr< std::streambuf >(
+                           new includize::memory_streambuf(broken.data(),
+                                                           broken.size())),
+                       includize::utf16_byte_order::detect) ==
+                base + text + u"\ufffdA");
+    }
+}
+
+TEST_CASE("file names", "[spec]")
+{
+    REQUIRE(includize::unescape_quotes("a \\\"b\\\" \\c\\") == "a \"b\" \\c\\");
+    REQUIRE(includize::toml_spec< wchar_t >::convert_filename(
+                L"p\u00e4rt \U0001f600.toml") ==
+            "p\xc3\xa4rt \xf0\x9f\x98\x80.toml");
+
+    const char16_t unpaired[] = u"\U0001f600\xd800";
+    REQUIRE(includize::utf8_encode(unpaired, unpaired + 3) ==
+            "\xf0\x9f\x98\x80\xef\xbf\xbd");
+}
+
+TEST_CASE("encoding detection", "[multibyte]")
+{
+    const auto utf16 = [](const std::u16string &text, bool big_endian) {
+        std::string bytes;
+
+        for (char16_t c : text)
+        {
+            bytes += char(big_endian ? c >> 8 : c & 0xff);
+            bytes += char(big_endian ? c & 0xff : c >> 8);
+        }
+
+        return bytes;
+    };
+
+    const auto add = [&utf16](includize::memory_resolver &files) {
+        files.add("base.toml",
+                  "a = \"\xc3\xa4\"\n"
+                  "# [[include \"le.toml\"]]\n"
+                  "# [[include \"be.toml\"]]\n"
+                  "# [[include \"bom.toml\"]]\n");
+        files.add("le.toml",
+                  utf16(u"b = \"\U0001f600\"\n# [[include \"c.toml\"]]\n",
+                        false));
+        files.add("be.toml", utf16(u"\ufeffd = \"\u4e2d\"\n", true));
+        files.add("bom.toml", "\xef\xbb\xbf" "e = 1\n");
+        files.add("c.toml", "\xff\xfe" + utf16(u"c = 2\n", false));
+    };
+
+    const std::u32string expected = U"a = \"\u00e4\"\n"
+                                    U"b = \"\U0001f600\"\n"
+                                    U"c = 2\n\n\n"
+                                    U"d = \"\u4e2d\"\n\n"
+                                    U"e = 1\n\n";
+
+    using preprocessor_type = includize::basic_preprocessor<
+        includize::toml_spec< char32_t >,
+        char32_t,
+        std::char_traits< char32_t >,
+        includize::auto_stream_preparer< char32_t > >;
+
+    SECTION("in memory")
+    {
+        std::shared_ptr< includize::memory_resolver > files =
+            std::make_shared< includize::memory_resolver >();
+        add(*files);
+
+        preprocessor_type pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+        REQUIRE(read_all(pp.stream()) == expected);
+    }
+
+    SECTION("streamed")
+    {
+        std::shared_ptr< streaming_resolver > files =
+            std::make_shared< streaming_resolver >();
+        add(*files);
+
+        preprocessor_type pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+        REQUIRE(read_all(pp.stream()) == expected);
+
+        pp.stream().clear();
+        pp.stream().seekg(0);
+        REQUIRE(read_all(pp.stream()) == expected);
+    }
+}
+
+TEST_CASE("line endings", "[streambuf]")
+{
+    // the \r\n of the first line of the part straddles the first block
+    const std::string part = std::string(8191, 'x') + "\r\ny = 2\r\n";
+
+    std::shared_ptr< streaming_resolver > files =
+        std::make_shared< streaming_resolver >();
+    files->add("base.toml",
+               "[table]\r\n"
+               "# [[include \"part.toml\"]]\r\n"
+               "lone = \"\r\"\r\n");
+    files->add("part.toml", part);
+
+    const std::string expected = "[table]\n" + std::string(8191, 'x') +
+                                 "\ny = 2\n\nlone = \"\r\"\n";
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(files);
+    pp.rdbuf().normalize_line_endings();
+
+    REQUIRE(read_all(pp.stream()) == expected);
+
+    pp.stream().clear();
+    REQUIRE(pp.stream().seekg(8195));
+    REQUIRE(read_all(pp.stream()) == expected.substr(8195));
+
+    includize::toml_preprocessor in_memory("base.toml");
+    std::shared_ptr< includize::memory_resolver > memory =
+        std::make_shared< includize::memory_resolver >();
+    memory->add("base.toml", "a = 1\r\n# [[include \"part.toml\"]]\r");
+    memory->add("part.toml", "b = ${B}\r\n");
+    in_memory.rdbuf().set_resolver(memory);
+    in_memory.rdbuf().define("B", "2");
+    in_memory.rdbuf().enable_substitution();
+    in_memory.rdbuf().normalize_line_endings();
+
+    REQUIRE(read_all(in_memory.stream()) == "a = 1\nb = 2\n");
+}
+
+TEST_CASE("long lines", "[streambuf]")
+{
+    const std::string tail(100000, 'x');
+
+    std::shared_ptr< streaming_resolver > files =
+        std::make_shared< streaming_resolver >();
+    files->add("base.toml",
+               "# [[include \"part.toml\"]] " + tail + "\n" +
+               "# " + tail + " [[include \"part.toml\"]]\n" +
+               "a = 1\n");
+    files->add("part.toml", "b = 2\n");
+
+    const std::string expected =
+        "b = 2\n\n# " + tail + " [[include \"part.toml\"]]\na = 1\n";
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(files);
+    pp.rdbuf().set_lookahead(1024);
+
+    REQUIRE(read_all(pp.stream()) == expected);
+
+    for (std::size_t pos : {std::size_t(3), std::size_t(6), std::size_t(5000)})
+    {
+        pp.stream().clear();
+        REQUIRE(pp.stream().seekg(pos));
+        REQUIRE(read_all(pp.stream()) == expected.substr(pos));
+    }
+
+    // too short a lookahead would miss every directive
+    includize::toml_preprocessor short_lookahead("base.toml");
+    short_lookahead.rdbuf().set_resolver(files);
+    short_lookahead.rdbuf().set_lookahead(1);
+
+    REQUIRE(read_all(short_lookahead.stream()) == expected);
+}
+
+TEST_CASE("line anchored", "[spec]")
+{
+    // the second header start of the base is mid-line, at the start of the
+    // second block
+    const std::string base = "a = [1, [2]] # [[include \"b.toml\"]]\n"
+                             "  # [[include \"b.toml\"]]\n" +
+                             std::string(8192 - 62, 'x') + " " +
+                             "# [[include \"b.toml\"]]\n" +
+                             "# [[include \"b.toml\"]]\n";
+
+    std::shared_ptr< streaming_resolver > files =
+        std::make_shared< streaming_resolver >();
+    files->add("base.toml", base);
+    files->add("b.toml", "b = 1\n");
+
+    const std::string expected = "a = [1, [2]] # [[include \"b.toml\"]]\n"
+                                 "  b = 1\n\n" +
+                                 std::string(8192 - 62, 'x') + " " +
+                                 "# [[include \"b.toml\"]]\n" +
+                                 "b = 1\n\n";
+
+    REQUIRE(base.substr(8192, 2) == "# ");
+
+    using spec = includize::line_anchored_spec< includize::toml_spec< char > >;
+    includize::basic_preprocessor< spec, char > pp("base.toml");
+    pp.rdbuf().set_resolver(files);
+
+    REQUIRE(read_all(pp.stream()) == expected);
+
+    pp.stream().clear();
+    REQUIRE(pp.stream().seekg(8190));
+    REQUIRE(read_all(pp.stream()) == expected.substr(8190));
+
+    using both = includize::multi_spec<
+        includize::line_anchored_spec< includize::toml_spec< char > >,
+        includize::universal_spec< char > >;
+
+    REQUIRE(includize::include_spec_traits< spec >::line_anchored());
+    REQUIRE(!includize::include_spec_traits< both >::line_anchored());
+}
+
+struct literal_spec : includize::toml_spec< char >
+{
+    static constexpr const char *literal() { return "[[include \"a"; }
+};
+
+TEST_CASE("literals", "[spec]")
+{
+    const auto matches = [](const std::string &line, bool toml) {
+        includize::include_directive< char > directive;
+        const auto holds = [](const char *, const char *, const char *,
+                              const char *) { return true; };
+        const char *begin = line.data();
+        const char *end = begin + line.size();
+
+        return toml ? includize::include_spec_traits< literal_spec >::match(
+                          begin, end, directive, holds)
+                    : includize::include_spec_traits<
+                          includize::universal_spec< char > >::match(
+                          begin, end, directive, holds);
+    };
+
+    REQUIRE(matches("# [[include \"a.toml\"]]", true));
+    REQUIRE(!matches("# [[include \"b.toml\"]]", true));
+    REQUIRE(!matches("# [[includ \"a.toml\"]]", true));
+    REQUIRE(!matches("# [[includ", true));
+    REQUIRE(matches("[[ #includize \"a.txt\" ]]", false));
+    REQUIRE(!matches("[[ #include \"a.txt\" ]]", false));
+}
+
+TEST_CASE("plain files", "[streambuf]")
+{
+    std::shared_ptr< includize::memory_resolver > files =
+        std::make_shared< includize::memory_resolver >();
+    files->add("base.toml",
+               "# [[include \"plain.toml\"]]\n"
+               "# [[include \"nested.toml\"]]\n"
+               "# [[include \"plain.toml\"]]\n");
+    files->add("plain.toml", "# comment\n[table]\na = [1, 2] # ${A}\n");
+    files->add("nested.toml", "[x]\n# [[include \"plain.toml\"]]\n");
+
+    const std::string plain = "# comment\n[table]\na = [1, 2] # ${A}\n";
+    const std::string expected =
+        plain + "\n[x]\n" + plain + "\n\n" + plain + "\n";
+
+    std::shared_ptr< includize::content_cache > cache =
+        std::make_shared< includize::content_cache >();
+
+    for (int i = 0; i < 2; ++i)
+    {
+        includize::toml_preprocessor pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+        pp.rdbuf().set_content_cache(cache);
+
+        REQUIRE(read_all(pp.stream()) == expected);
+
+        pp.stream().clear();
+        REQUIRE(pp.stream().seekg(40));
+        REQUIRE(read_all(pp.stream()) == expected.substr(40));
+    }
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(files);
+    pp.rdbuf().set_content_cache(cache);
+    pp.rdbuf().define("A", "1");
+    pp.rdbuf().enable_substitution();
+
+    std::string substituted = plain;
+    substituted.replace(substituted.find("${A}"), 4, "1");
+    REQUIRE(read_all(pp.stream()) == substituted + "\n[x]\n" + substituted +
+                                         "\n\n" + substituted + "\n");
+
+    const std::string text = "[[ #includize \"plain.toml\" ]]\n";
+    includize::universal_preprocessor from_memory(text.data(), text.size());
+    from_memory.rdbuf().set_resolver(files);
+    REQUIRE(read_all(from_memory.stream()) == plain + "\n");
+
+    // a plain file is a single get area, even with header starts in it
+    includize::toml_preprocessor one_piece("plain.toml");
+    one_piece.rdbuf().set_resolver(files);
+    REQUIRE(one_piece.stream().get() == '#');
+    REQUIRE(one_piece.rdbuf().in_avail() ==
+            static_cast< std::streamsize >(plain.size() - 1));
+
+    // the answer is kept for the memory, not for the name of the file, so
+    // streams sharing the cache never take one file for another
+    std::shared_ptr< includize::memory_resolver > others =
+        std::make_shared< includize::memory_resolver >();
+    others->add("base.toml", "# [[include \"plain.toml\"]]\n");
+    others->add("plain.toml", "# [[include \"q.toml\"]]\n");
+    others->add("q.toml", "q = 1\n");
+
+    for (int i = 0; i < 2; ++i)
+    {
+        includize::toml_preprocessor other("base.toml");
+        other.rdbuf().set_resolver(others);
+        other.rdbuf().set_content_cache(cache);
+        REQUIRE(read_all(other.stream()) == "q = 1\n\n\n");
+
+        others->add("plain.toml", "# [[include \"q.toml\"]] \n");
+    }
+
+    std::shared_ptr< const void > owner = std::make_shared< int >(0);
+    bool known = false;
+
+    includize::content_cache answers;
+    answers.insert_plain("key", owner, true);
+    REQUIRE(answers.find_plain("key", owner, known));
+    REQUIRE(known);
+    REQUIRE(!answers.find_plain("key", std::make_shared< int >(0), known));
+    owner.reset();
+    REQUIRE(!answers.find_plain("key", owner, known));
+}
+
+TEST_CASE("plain lines", "[streambuf]")
+{
+    // lines with header starts but no directives, with a directive on the
+    // line that runs across the end of the first block
+    std::string lines;
+
+    for (int i = 0; lines.size() < 8150; ++i)
+    {
+        lines += "a" + std::to_string(i) + " = " + std::to_string(i) +
+                 " # comment\n";
+    }
+
+    const std::string tail(8192 - lines.size() - 8, ' ');
+    const std::string base = lines + tail + "# [[include \"b.toml\"]]\n" +
+                             lines;
+
+    std::shared_ptr< streaming_resolver > files =
+        std::make_shared< streaming_resolver >();
+    files->add("base.toml", base);
+    files->add("b.toml", "b = 1\n");
+
+    const std::string expected = lines + tail + "b = 1\n\n" + lines;
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(files);
+
+    REQUIRE(pp.stream().get() == 'a');
+    REQUIRE(pp.rdbuf().in_avail() ==
+            static_cast< std::streamsize >(lines.size() - 1));
+
+    pp.stream().unget();
+    REQUIRE(read_all(pp.stream()) == expected);
+
+    pp.stream().clear();
+    REQUIRE(pp.stream().seekg(100));
+    REQUIRE(read_all(pp.stream()) == expected.substr(100));
+}
+
+TEST_CASE("sources", "[preprocessor]")
+{
+    std::ifstream orig_infile("tests/orig.txt");
+    const std::string orig = read_all< char >(orig_infile);
+
+    std::ifstream base_infile("tests/base.txt");
+    const std::string base = read_all< char >(base_infile);
+
+    SECTION("memory")
+    {
+        includize::universal_preprocessor pp(
+            base.data(), base.size(), "tests");
+
+        REQUIRE(read_all(pp.stream()) + "\n" == orig);
+    }
+
+    SECTION("istream")
+    {
+        std::istringstream in(base);
+        includize::universal_preprocessor pp(in, "tests/");
+
+        REQUIRE(read_all(pp.stream()) + "\n" == orig);
+    }
+}
+
+TEST_CASE("resolver", "[resolver]")
+{
+    std::shared_ptr< includize::memory_resolver > files =
+        std::make_shared< includize::memory_resolver >();
+
+    static const char shared[] = "shared = true\n";
+
+    files->add("conf/base.toml",
+               "[table]\n"
+               "# [[include \"parts/part.toml\"]]\n"
+               "key = 1\n");
+    files->add("conf/parts/part.toml", "# [[include \"../../shared.toml\"]]\n");
+    files->add("shared.toml", shared, sizeof(shared) - 1);
+
+    includize::toml_preprocessor pp("conf/base.toml");
+    pp.rdbuf().set_resolver(files);
+
+    REQUIRE(read_all(pp.stream()) ==
+            "[table]\nshared = true\n\n\nkey = 1\n");
+    REQUIRE(includize::normalize_path("/a/./b//../c") ==
+            "/a/c");
+}
+
+class counting_resolver : public includize::memory_resolver
+{
+public:
+    using includize::memory_resolver::open;
+
+    counting_resolver() : opens(0) {}
+
+    std::unique_ptr< std::streambuf > open(const std::string &name) override
+    {
+        ++opens;
+        return includize::memory_resolver::open(name);
+    }
+
+    std::size_t opens;
+};
+
+TEST_CASE("include paths", "[resolver]")
+{
+    std::shared_ptr< counting_resolver > files =
+        std::make_shared< counting_resolver >();
+
+    files->add("conf/base.toml",
+               "# [[include \"common.toml\"]]\n"
+               "# [[include \"missing.toml\"]]\n"
+               "# [[include \"common.toml\"]]\n"
+               "# [[include \"missing.toml\"]]\n");
+    files->add("lib/b/common.toml", "common = true");
+
+    includize::toml_preprocessor pp("conf/base.toml");
+    pp.rdbuf().set_resolver(files);
+    pp.rdbuf().add_include_path("lib/a");
+    pp.rdbuf().add_include_path("lib/b/");
+
+    REQUIRE(read_all(pp.stream()) ==
+            "common = true\n\ncommon = true\n\n");
+
+    // the root, three candidates for each name, then one open for the
+    // second common.toml and none for the second missing.toml
+    REQUIRE(files->opens == 1 + 3 + 3 + 1);
+}
+
+TEST_CASE("working directory", "[resolver]")
+{
+    std::ifstream orig_infile("tests/orig.toml");
+    const std::string orig = read_all< char >(orig_infile);
+
+    char cwd[4096];
+    REQUIRE(getcwd(cwd, sizeof(cwd)));
+
+    includize::toml_preprocessor pp("tests/base.toml");
+    const int c = pp.stream().get();
+
+    // includes are opened relative to the directory the root was found in,
+    // not the current working directory
+    REQUIRE(chdir("/") == 0);
+    const std::string rest = read_all(pp.stream());
+    REQUIRE(chdir(cwd) == 0);
+
+    REQUIRE(std::string(1, static_cast< char >(c)) + rest + "\n" == orig);
+
+    // the root and include paths are relative to the working directory at
+    // the time they were given, even before anything is read
+    const std::string text = "# [[include \"included.toml\"]]\n";
+    includize::toml_preprocessor from_path("tests/base.toml");
+    includize::toml_preprocessor from_include_path(
+        text.data(), text.size(), "/nonexistent");
+    from_include_path.rdbuf().add_include_path("tests");
+
+    REQUIRE(chdir("/") == 0);
+    const std::string expanded = read_all(from_path.stream());
+    const std::string included = read_all(from_include_path.stream());
+    REQUIRE(chdir(cwd) == 0);
+
+    std::ifstream included_infile("tests/included.toml");
+    REQUIRE(included == read_all< char >(included_infile) + "\n");
+    REQUIRE(expanded + "\n" == orig);
+}
+
+TEST_CASE("bundle", "[resolver]")
+{
+    std::ifstream base_infile("tests/base.toml");
+    std::ifstream included_infile("tests/included.toml");
+    std::ifstream orig_infile("tests/orig.toml");
+    const std::string orig = read_all< char >(orig_infile);
+
+    char file_name[] = "/tmp/includize-bundle-XXXXXX";
+    const int fd = mkstemp(file_name);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    includize::bundle_writer writer;
+    writer.add("conf/base.toml", read_all< char >(base_infile));
+    writer.add("conf/./included.toml", read_all< char >(included_infile));
+    writer.add("other.toml", "");
+    REQUIRE(writer.write(file_name));
+
+    std::shared_ptr< includize::bundle_resolver > bundle =
+        std::make_shared< includize::bundle_resolver >(file_name);
+    unlink(file_name);
+
+    REQUIRE(bundle->is_open());
+    REQUIRE(bundle->size() == 3);
+    REQUIRE(!bundle->open("conf/missing.toml"));
+    REQUIRE(bundle->list("conf/") ==
+            std::vector< std::string >({"base.toml", "included.toml"}));
+
+    includize::toml_preprocessor pp("conf/base.toml");
+    pp.rdbuf().set_resolver(bundle);
+
+    REQUIRE(read_all(pp.stream()) + "\n" == orig);
+}
+
+TEST_CASE("uncompressed files", "[resolver]")
+{
+    // every line has the literal of a directive, so the root is read in
+    // blocks that bypass the buffer the magic bytes were sniffed into, and
+    // seeking back restores checkpoints within the last blocks read
+    std::string text;
+
+    for (int i = 0; text.size() < 20000; ++i)
+    {
+        text += "key" + std::to_string(i) + " = \"[[include\"\n";
+    }
+
+    char file_name[] = "/tmp/includize-uncompressed-XXXXXX";
+    const int fd = mkstemp(file_name);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, text.data(), text.size()) ==
+            static_cast< ssize_t >(text.size()));
+    close(fd);
+
+    includize::toml_preprocessor pp(file_name);
+    pp.rdbuf().set_resolver(
+        std::make_shared< includize::decompressing_resolver >());
+
+    std::vector< char > head(9000);
+    REQUIRE(pp.stream().read(head.data(), head.size()));
+    REQUIRE(std::string(head.data(), head.size()) == text.substr(0, 9000));
+
+    for (std::size_t pos : {8500, 17000, 100, 16500, 8192})
+    {
+        pp.stream().clear();
+        REQUIRE(pp.stream().seekg(pos));
+        REQUIRE(read_all(pp.stream()) == text.substr(pos));
+    }
+
+    unlink(file_name);
+}
+
+#ifdef INCLUDIZE_HAVE_ZLIB
+TEST_CASE("decompress", "[resolver]")
+{
+    std::ifstream base_infile("tests/base.toml");
+    std::ifstream included_infile("tests/included.toml");
+    std::ifstream orig_infile("tests/orig.toml");
+    const std::string orig = read_all< char >(orig_infile);
+    const std::string included = read_all< char >(included_infile);
+
+    // two gzip members, as concatenated .gz files are
+    std::string compressed;
+
+    for (std::size_t i = 0; i < 2; ++i)
+    {
+        const std::string half = included.substr(
+            i * included.size() / 2,
+            (i + 1) * included.size() / 2 - i * included.size() / 2);
+        std::vector< unsigned char > out(compressBound(half.size()) + 64);
+        z_stream z;
+        std::memset(&z, 0, sizeof(z));
+        REQUIRE(deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                             Z_DEFAULT_STRATEGY) == Z_OK);
+        z.next_in = reinterpret_cast< Bytef * >(const_cast< char * >(
+            half.data()));
+        z.avail_in = half.size();
+        z.next_out = out.data();
+        z.avail_out = out.size();
+        REQUIRE(deflate(&z, Z_FINISH) == Z_STREAM_END);
+        compressed.append(reinterpret_cast< char * >(out.data()),
+                          out.size() - z.avail_out);
+        deflateEnd(&z);
+    }
+
+    std::string base = read_all< char >(base_infile);
+
+    std::shared_ptr< includize::memory_resolver > files =
+        std::make_shared< includize::memory_resolver >();
+    files->add("base.toml", base);
+    files->add("included.toml", compressed);
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(
+        std::make_shared< includize::decompressing_resolver >(files));
+
+    const std::string expanded = read_all(pp.stream());
+    REQUIRE(expanded + "\n" == orig);
+
+    // the extension alone is enough, and the expansion can be reread
+    files->add("included.toml.gz", compressed);
+    const std::string::size_type at = base.find("included.toml");
+    REQUIRE(at != std::string::npos);
+    files->add("base.toml", base.insert(at + 13, ".gz"));
+
+    includize::toml_preprocessor gz("base.toml");
+    gz.rdbuf().set_resolver(
+        std::make_shared< includize::decompressing_resolver >(files));
+
+    REQUIRE(read_all(gz.stream()) == expanded);
+    gz.stream().clear();
+    gz.stream().seekg(0);
+    REQUIRE(read_all(gz.stream()) == expanded);
+    gz.stream().clear();
+    gz.stream().seekg(expanded.size() / 2);
+    REQUIRE(read_all(gz.stream()) == expanded.substr(expanded.size() / 2));
+
+    // a file that is cut short or corrupt fails rather than reading as a
+    // shorter one
+    // past the 10 byte header of the first member
+    std::string corrupt = compressed;
+    corrupt[12] ^= 0x55;
+    files->add("truncated.gz", compressed.substr(0, compressed.size() - 4));
+    files->add("corrupt.gz", corrupt);
+
+    for (const char *name : {"truncated.gz", "corrupt.gz"})
+    {
+        includize::gzip_streambuf bytes(files->open(name));
+        std::istream in(&bytes);
+        std::string contents;
+
+        in.exceptions(std::ios::badbit);
+        REQUIRE_THROWS_AS(std::getline(in, contents, '\0'),
+                          const std::ios_base::failure &);
+
+        const std::string text =
+            std::string("# [[include \"") + name + "\"]]\n";
+        includize::toml_preprocessor failed(text.data(), text.size());
+        failed.rdbuf().set_resolver(
+            std::make_shared< includize::decompressing_resolver >(files));
+
+        while (std::getline(failed.stream(), contents))
+        {
+        }
+
+        REQUIRE(failed.stream().bad());
+    }
+}
+#endif
+
+TEST_CASE("zstd", "[resolver]")
+{
+    std::ifstream included_infile("tests/included.toml");
+    const std::string included = read_all< char >(included_infile);
+
+    std::shared_ptr< includize::memory_resolver > files =
+        std::make_shared< includize::memory_resolver >();
+    files->add("base.toml",
+               "a = 1\n# [[include \"included.toml.zst\"]]\nb = 2\n");
+
+#ifdef INCLUDIZE_HAVE_ZSTD
+    // two frames, as concatenated .zst files are
+    std::string compressed;
+
+    for (std::size_t i = 0; i < 2; ++i)
+    {
+        const std::string half = included.substr(
+            i * included.size() / 2,
+            (i + 1) * included.size() / 2 - i * included.size() / 2);
+        std::vector< char > out(ZSTD_compressBound(half.size()));
+        const std::size_t n = ZSTD_compress(
+            out.data(), out.size(), half.data(), half.size(), 19);
+        REQUIRE(!ZSTD_isError(n));
+        compressed.append(out.data(), n);
+    }
+
+    files->add("included.toml.zst", compressed);
+
+    // recognized by its magic bytes as well as by its extension
+    files->add("renamed.toml", compressed);
+    files->add("renamed_base.toml", "# [[include \"renamed.toml\"]]\n");
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(
+        std::make_shared< includize::decompressing_resolver >(files));
+
+    const std::string expanded = "a = 1\n" + included + "\nb = 2\n";
+    REQUIRE(read_all(pp.stream()) == expanded);
+    pp.stream().clear();
+    pp.stream().seekg(expanded.size() / 2);
+    REQUIRE(read_all(pp.stream()) == expanded.substr(expanded.size() / 2));
+
+    includize::toml_preprocessor renamed("renamed_base.toml");
+    renamed.rdbuf().set_resolver(
+        std::make_shared< includize::decompressing_resolver >(files));
+    REQUIRE(read_all(renamed.stream()) == included + "\n");
+
+    // a file that is cut short or corrupt fails rather than reading as a
+    // shorter one
+    // past the frame header of the first frame
+    std::string corrupt = compressed;
+    corrupt[12] ^= 0x55;
+    files->add("truncated.zst", compressed.substr(0, compressed.size() - 4));
+    files->add("corrupt.zst", corrupt);
+
+    for (const char *name : {"truncated.zst", "corrupt.zst"})
+    {
+        includize::zstd_streambuf bytes(files->open(name));
+        std::istream in(&bytes);
+        std::string contents;
+
+        in.exceptions(std::ios::badbit);
+        REQUIRE_THROWS_AS(std::getline(in, contents, '\0'),
+                          const std::ios_base::failure &);
+    }
+#else
+    // without zstd support a zstd file fails to open rather than being
+    // expanded as the compressed bytes
+    files->add("included.toml.zst", included);
+    files->add("renamed.toml", std::string("\x28\xb5\x2f\xfd", 4) + included);
+    files->add("renamed_base.toml", "# [[include \"renamed.toml\"]]\n");
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(
+        std::make_shared< includize::decompressing_resolver >(files));
+    REQUIRE(read_all(pp.stream()) == "a = 1\n\nb = 2\n");
+
+    includize::toml_preprocessor renamed("renamed_base.toml");
+    renamed.rdbuf().set_resolver(
+        std::make_shared< includize::decompressing_resolver >(files));
+    REQUIRE(read_all(renamed.stream()) == "\n");
+#endif
+}
+
+TEST_CASE("ranges", "[range]")
+{
+    std::string big;
+
+    for (int i = 1; i <= 1000; ++i)
+    {
+        big += "line " + std::to_string(i) + "\n";
+    }
+
+    const std::string expected =
+        "line 2\nline 3\n\n"
+        "line 600\nline 601\n\n"
+        "line 300\n\n"
+        "line 999\nline 1000\n\n"
+        "line 2\n\n"
+        "line 1000\n\n"
+        "\n";
+
+    SECTION("memory")
+    {
+        std::shared_ptr< includize::memory_resolver > files =
+            std::make_shared< includize::memory_resolver >();
+        files->add("big.txt", big);
+        files->add("base.toml",
+                   "#[[include \"big.txt\" lines 2-3]]\n"
+                   "#[[include \"big.txt\" lines 600-601]]\n"
+                   "#[[include \"big.txt\" lines 300-300]]\n"
+                   "#[[include \"big.txt\" lines 999-]]\n"
+                   "#[[include \"big.txt\" bytes 7-13]]\n"
+                   "#[[include \"big.txt\" bytes 8883-]]\n"
+                   "#[[include \"big.txt\" lines 1001-1005]]\n");
+
+        includize::toml_preprocessor pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        REQUIRE(read_all(pp.stream()) == expected);
+    }
+
+    SECTION("file")
+    {
+        char file_name[] = "/tmp/includize-range-XXXXXX";
+        const int fd = mkstemp(file_name);
+        REQUIRE(fd >= 0);
+        REQUIRE(write(fd, big.data(), big.size()) ==
+                static_cast< ssize_t >(big.size()));
+        close(fd);
+
+        const std::string name = file_name;
+        const std::string base =
+            "#[[include \"" + name + "\" lines 2-3]]\n" +
+            "#[[include \"" + name + "\" lines 600-601]]\n" +
+            "#[[include \"" + name + "\" lines 300-300]]\n" +
+            "#[[include \"" + name + "\" lines 999-]]\n" +
+            "#[[include \"" + name + "\" bytes 7-13]]\n" +
+            "#[[include \"" + name + "\" bytes 8883-]]\n" +
+            "#[[include \"" + name + "\" lines 1001-1005]]\n";
+
+        includize::toml_preprocessor pp(base.data(), base.size());
+
+        REQUIRE(read_all(pp.stream()) == expected);
+
+        pp.stream().clear();
+        pp.stream().seekg(10);
+        REQUIRE(read_all(pp.stream()) == expected.substr(10));
+
+        unlink(file_name);
+    }
+
+    SECTION("invalid")
+    {
+        std::shared_ptr< includize::memory_resolver > files =
+            std::make_shared< includize::memory_resolver >();
+        files->add("big.txt", big);
+
+        for (const char *range : {"lines 0-1",
+                                  "lines 5-3",
+                                  "bytes 9223372036854775807-",
+                                  "bytes 0-18446744073709551615",
+                                  "lines 99999999999999999999999-"})
+        {
+            const std::string base = std::string("a = 1\n#[[include "
+                                                 "\"big.txt\" ") +
+                                     range + "]]\n";
+            includize::toml_preprocessor pp(base.data(), base.size());
+            pp.rdbuf().set_resolver(files);
+
+            std::string line;
+            REQUIRE(std::getline(pp.stream(), line));
+            REQUIRE(line == "a = 1");
+            REQUIRE(!std::getline(pp.stream(), line));
+            REQUIRE(pp.stream().bad());
+        }
+    }
+}
+
+TEST_CASE("wildcards", "[resolver]")
+{
+    SECTION("memory")
+    {
+        std::shared_ptr< includize::memory_resolver > files =
+            std::make_shared< includize::memory_resolver >();
+        files->add("base.toml", "#[[include \"conf.d/*.toml\"]]\nend\n");
+        files->add("conf.d/b.toml", "b = 2\n");
+        files->add("conf.d/a.toml", "a = 1\n#[[include \"../x.toml\"]]\n");
+        files->add("conf.d/c.txt", "c = 3\n");
+        files->add("conf.d/.hidden.toml", "hidden = true\n");
+        files->add("conf.d/sub/d.toml", "d = 4\n");
+        files->add("x.toml", "x = 0\n");
+
+        includize::toml_preprocessor pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        REQUIRE(read_all(pp.stream()) == "a = 1\nx = 0\n\nb = 2\n\nend\n");
+        REQUIRE(files->list("conf.d") ==
+                std::vector< std::string >(
+                    {".hidden.toml", "a.toml", "b.toml", "c.txt"}));
+    }
+
+    SECTION("filesystem")
+    {
+        char dir_name[] = "/tmp/includize-glob-XXXXXX";
+        REQUIRE(mkdtemp(dir_name));
+
+        const std::string dir = dir_name;
+        std::string expected;
+
+        for (int i = 0; i < 40; ++i)
+        {
+            const std::string n = std::to_string(100 + i);
+            std::ofstream(dir + "/" + n + ".inc") << "value = " << n << "\n";
+            expected += "value = " + n + "\n";
+        }
+
+        const std::string base = "#[[include \"" + dir + "/1*.inc\"]]\n";
+        includize::toml_preprocessor pp(base.data(), base.size());
+
+        REQUIRE(read_all(pp.stream()) == expected + "\n");
+
+        pp.stream().clear();
+        pp.stream().seekg(expected.size() / 2);
+        REQUIRE(read_all(pp.stream()) ==
+                expected.substr(expected.size() / 2) + "\n");
+
+        for (int i = 0; i < 40; ++i)
+        {
+            unlink((dir + "/" + std::to_string(100 + i) + ".inc").c_str());
+        }
+
+        rmdir(dir_name);
+    }
+
+    SECTION("line ends")
+    {
+        // lines never run across files, so no directive can be lost or made
+        // up where one file ends without a newline
+        const std::string big(100000, 'x');
+
+        std::shared_ptr< streaming_resolver > files =
+            std::make_shared< streaming_resolver >();
+        files->add("base.toml", "#[[include \"conf.d/*.toml\"]]\nend\n");
+        files->add("conf.d/a.toml", "a = 1");
+        files->add("conf.d/b.toml", "#[[include \"../x.toml\"]]\n");
+        files->add("conf.d/c.toml", "#[[include \"../x.toml\"");
+        files->add("conf.d/d.toml", "]]\n" + big);
+        files->add("conf.d/e.toml", big + "\n");
+        files->add("x.toml", "x = 0\n");
+
+        const std::string expected = "a = 1\nx = 0\n\n"
+                                     "#[[include \"../x.toml\"\n]]\n" +
+                                     big + "\n" + big + "\n\nend\n";
+
+        includize::toml_preprocessor pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        REQUIRE(read_all(pp.stream()) == expected);
+
+        const std::size_t second = expected.find(big) + big.size() + 1;
+
+        for (std::size_t pos : {second + 70000, second - 1, std::size_t(5)})
+        {
+            pp.stream().clear();
+            REQUIRE(pp.stream().seekg(pos));
+            REQUIRE(read_all(pp.stream()) == expected.substr(pos));
+        }
+    }
+}
+
+TEST_CASE("multiple specs", "[spec]")
+{
+    SECTION("char")
+    {
+        using spec = includize::multi_spec< includize::toml_spec< char >,
+                                            includize::universal_spec< char > >;
+
+        std::shared_ptr< includize::memory_resolver > files =
+            std::make_shared< includize::memory_resolver >();
+        files->add("a.toml", "a = 1\n");
+        files->add("b.inc", "b = 2\n");
+        files->add("base.toml",
+                   "# plain comment, [not] a directive\n"
+                   "#[[include \"a.toml\"]]\n"
+                   "x = 1 # [[ #includize \"b.inc\" ]] dropped\n"
+                   "[table]\n"
+                   "[[ #includize \"b.inc\" ]]\n"
+                   "0123456789abcdef0123456789abcdef#[[include \"a.toml\"]]\n");
+
+        includize::basic_preprocessor< spec, char > pp("base.toml");
+        pp.rdbuf().set_resolver(files);
+
+        REQUIRE(read_all(pp.stream()) ==
+                "# plain comment, [not] a directive\n"
+                "a = 1\n\n"
+                "x = 1 # b = 2\n\n"
+                "[table]\n"
+                "b = 2\n\n"
+                "0123456789abcdef0123456789abcdefa = 1\n\n");
+    }
+
+    SECTION("wchar_t")
+    {
+        using spec =
+            includize::multi_spec< includize::toml_spec< wchar_t >,
+                                   includize::universal_spec< wchar_t > >;
+
+        const std::wstring base =
+            L"#[[include \"tests/included.toml\"]]\n"
+            L"[[ #includize \"tests/included.toml\"]]\n";
+        std::wifstream included_infile("tests/included.toml");
+        const std::wstring included = read_all< wchar_t >(included_infile);
+
+        includize::basic_preprocessor< spec, wchar_t > pp(base.data(),
+                                                           base.size());
+
+        REQUIRE(read_all(pp.stream()) ==
+                included + L"\n" + included + L"\n");
+    }
+}
+
+TEST_CASE("conditions", "[spec]")
+{
+    std::shared_ptr< counting_resolver > files =
+        std::make_shared< counting_resolver >();
+
+    files->add("base.toml",
+               "#[[include_if REGION=eu \"eu.toml\"]]\n"
+               "#[[include_if REGION=us \"us.toml\"]]\n"
+               "#[[include_unless REGION \"default.toml\"]]\n"
+               "#[[include_if INCLUDIZE_TEST_FLAG \"flag.toml\"]]\n"
+               "#[[include_unless INCLUDIZE_TEST_UNSET \"unset.toml\"]]\n"
+               "#[[include_if INCLUDIZE_TEST_FLAG=no \"flag.toml\"]]\n");
+    files->add("eu.toml", "region = \"eu\"\n");
+    files->add("us.toml", "region = \"us\"\n");
+    files->add("default.toml", "region = \"none\"\n");
+    files->add("flag.toml", "flag = true\n");
+    files->add("unset.toml", "unset = true\n");
+
+    setenv("INCLUDIZE_TEST_FLAG", "yes", 1);
+    unsetenv("INCLUDIZE_TEST_UNSET");
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(files);
+    pp.rdbuf().define("REGION", "eu");
+
+    REQUIRE(read_all(pp.stream()) ==
+            "region = \"eu\"\n\n\n\nflag = true\n\nunset = true\n\n\n");
+
+    // the excluded files are never opened
+    REQUIRE(files->opens == 1 + 3);
+
+    unsetenv("INCLUDIZE_TEST_FLAG");
+}
+
+TEST_CASE("substitution", "[substitution]")
+{
+    setenv("INCLUDIZE_TEST_HOME", "/home/test", 1);
+
+    std::shared_ptr< includize::memory_resolver > files =
+        std::make_shared< includize::memory_resolver >();
+    files->add("part.toml", "name = \"${NAME}\"\n");
+
+    const std::string lines = "home = \"${INCLUDIZE_TEST_HOME}\"\n"
+                              "#[[include \"part.toml\"]]\n"
+                              "cost = $5 ${} ${UNDEFINED} ${V7}${V250}$\n";
+
+    // a variable straddling the end of the first block
+    const std::string padding(8189 - lines.size(), ' ');
+    std::istringstream base(lines + padding + "${NAME}\n");
+
+    includize::toml_preprocessor pp(base);
+    pp.rdbuf().set_resolver(files);
+    pp.rdbuf().enable_substitution();
+    pp.rdbuf().define("NAME", "includize # [[include \"part.toml\"]]");
+
+    for (int i = 0; i < 300; ++i)
+    {
+        pp.rdbuf().define("V" + std::to_string(i), std::to_string(i * i));
+    }
+
+    const std::string expected =
+        "home = \"/home/test\"\n"
+        "name = \"includize # [[include \"part.toml\"]]\"\n\n"
+        "cost = $5 ${} ${UNDEFINED} 4962500$\n" +
+        padding + "includize # [[include \"part.toml\"]]\n";
+
+    REQUIRE(read_all(pp.stream()) == expected);
+
+    pp.stream().clear();
+    pp.stream().seekg(20);
+    REQUIRE(read_all(pp.stream()) == expected.substr(20));
+
+    unsetenv("INCLUDIZE_TEST_HOME");
+
+    // defining a variable while its value is being read leaves the rest of
+    // the value in place
+    const std::string text = "v = ${A} ${A}\n";
+    const std::string first(1000, 'a');
+    const std::string second(1000, 'b');
+    includize::toml_preprocessor redefined(text.data(), text.size());
+    redefined.rdbuf().enable_substitution();
+    redefined.rdbuf().define("A", first);
+
+    char start[8];
+    REQUIRE(redefined.stream().read(start, sizeof(start)));
+    redefined.rdbuf().define("B", "1");
+    redefined.rdbuf().define("A", second);
+
+    REQUIRE(std::string(start, sizeof(start)) + read_all(redefined.stream()) ==
+            "v = " + first + " " + second + "\n");
+
+    // values are UTF-8, and are decoded for wider character types
+    setenv("INCLUDIZE_TEST_CITY", "Z\xc3\xbcrich", 1);
+
+    const std::wstring wide_text =
+        L"city = \"${INCLUDIZE_TEST_CITY}\" ${CLEF}\n"
+        L"#[[include_if INCLUDIZE_TEST_CITY=Z\u00fcrich "
+        L"\"tests/included.toml\"]]\n";
+    includize::basic_preprocessor< includize::toml_spec< wchar_t >, wchar_t >
+        wide(wide_text.data(), wide_text.size());
+    wide.rdbuf().enable_substitution();
+    wide.rdbuf().define("CLEF", "\xf0\x9d\x84\x9e");
+
+    std::wifstream included_infile("tests/included.toml");
+    REQUIRE(read_all(wide.stream()) ==
+            L"city = \"Z\u00fcrich\" \U0001d11e\n" +
+                read_all< wchar_t >(included_infile) + L"\n");
+
+    const std::u16string utf16_text =
+        u"city = \"${INCLUDIZE_TEST_CITY}\" ${CLEF}\n";
+    includize::basic_preprocessor< includize::toml_spec< char16_t >,
+                                   char16_t >
+        utf16(utf16_text.data(), utf16_text.size());
+    utf16.rdbuf().enable_substitution();
+    utf16.rdbuf().define("CLEF", "\xf0\x9d\x84\x9e");
+
+    REQUIRE(read_all(utf16.stream()) ==
+            u"city = \"Z\u00fcrich\" \U0001d11e\n");
+
+    unsetenv("INCLUDIZE_TEST_CITY");
+}
+
+TEST_CASE("templates", "[template]")
+{
+    std::shared_ptr< counting_resolver > files =
+        std::make_shared< counting_resolver >();
+
+    std::string base;
+    std::string expected;
+
+    for (int i = 0; i < 500; ++i)
+    {
+        const std::string shard = std::to_string(i % 8);
+        const std::string region = (i % 8 < 4) ? "eu" : "us";
+
+        base += "#[[include \"shard.toml\" with region=" + region +
+                " shard=" + shard + "]]\n";
+        expected += "[shard" + shard + "]\nregion = \"" + region +
+                    "\"\nzone = " + region + "-1\nother = \"${other}\"\n\n";
+    }
+
+    files->add("base.toml", base);
+    files->add("shard.toml",
+               "[shard${shard}]\n"
+               "region = \"${region}\"\n"
+               "#[[include \"zones/${region}.toml\"]]\n"
+               "other = \"${other}\"\n");
+    files->add("zones/eu.toml", "zone = eu-1");
+    files->add("zones/us.toml", "zone = us-1");
+
+    std::shared_ptr< includize::content_cache > cache =
+        std::make_shared< includize::content_cache >();
+
+    includize::toml_preprocessor pp("base.toml");
+    pp.rdbuf().set_resolver(files);
+    pp.rdbuf().set_content_cache(cache);
+
+    REQUIRE(read_all(pp.stream()) == expected);
+    REQUIRE(cache->size() == 8);
+
+    // the root, each instance once, each zone for every include of it
+    REQUIRE(files->opens == 1 + 8 + 500);
+
+    pp.stream().clear();
+    pp.stream().seekg(expected.size() / 3);
+    REQUIRE(read_all(pp.stream()) == expected.substr(expected.size() / 3));
+
+    // another expansion sharing the cache renders nothing
+    files->opens = 0;
+    includize::toml_preprocessor again("base.toml");
+    again.rdbuf().set_resolver(files);
+    again.rdbuf().set_content_cache(cache);
+
+    REQUIRE(read_all(again.stream()) == expected);
+    REQUIRE(files->opens == 1 + 500);
+    REQUIRE(cache->size() == 8);
+
+    // every instance has lines of its own length, so each is indexed apart
+    std::string lines;
+
+    for (int i = 1; i <= 600; ++i)
+    {
+        lines += "line" + std::to_string(i) + " = \"${v}\"\n";
+    }
+
+    files->add("lines.toml", lines);
+    files->add("ranges.toml",
+               "#[[include \"lines.toml\" lines 300-300 with v=a]]\n"
+               "#[[include \"lines.toml\" lines 300-300 with "
+               "v=a_much_longer_value]]\n");
+
+    includize::toml_preprocessor ranges("ranges.toml");
+    ranges.rdbuf().set_resolver(files);
+
+    REQUIRE(read_all(ranges.stream()) ==
+            "line300 = \"a\"\n\nline300 = \"a_much_longer_value\"\n\n");
+
+    // streams with other resolvers sharing the cache render their own
+    // templates of the same name
+    std::shared_ptr< includize::memory_resolver > others =
+        std::make_shared< includize::memory_resolver >();
+    others->add("base.toml",
+                "#[[include \"shard.toml\" with region=eu shard=1]]\n");
+    others->add("shard.toml", "other = ${shard}\n");
+
+    includize::toml_preprocessor other("base.toml");
+    other.rdbuf().set_resolver(others);
+    other.rdbuf().set_content_cache(cache);
+
+    REQUIRE(read_all(other.stream()) == "other = 1\n\n");
+    REQUIRE(cache->size() == 9);
+
+    // templates are rendered once they are decoded, with the values decoded
+    // from UTF-8 to match
+    const std::u16string utf16 = u"\ufeffcity = \"${city}\"\n";
+    std::string utf16_bytes;
+
+    for (char16_t c : utf16)
+    {
+        utf16_bytes += static_cast< char >(c & 0xff);
+        utf16_bytes += static_cast< char >(c >> 8);
+    }
+
+    others->add("city.toml", utf16_bytes);
+
+    const std::wstring wide_base =
+        L"#[[include \"city.toml\" with city=Z\u00fcrich]]\n";
+    includize::basic_preprocessor< includize::toml_spec< wchar_t >,
+                                   wchar_t,
+                                   std::char_traits< wchar_t >,
+                                   includize::wstream_utf16_header_preparer >
+        wide(wide_base.data(), wide_base.size());
+    wide.rdbuf().set_resolver(others);
+    wide.rdbuf().set_content_cache(cache);
+
+    REQUIRE(read_all(wide.stream()) == L"city = \"Z\u00fcrich\"\n\n");
+}
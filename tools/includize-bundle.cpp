@@ -0,0 +1,132 @@
+/* Copyright (c) 2017, Daniel C. Dillon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Packs a directory tree into a bundle that bundle_resolver can serve
+// includes from:
+//
+//     includize-bundle <output> <directory>
+//
+// Names in the bundle are relative to <directory>.
+
+#include "../include/includize/bundle.hpp"
+
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+
+namespace
+{
+bool add_tree(includize::bundle_writer &writer,
+              const std::string &root,
+              const std::string &relative)
+{
+    const std::string path = root + "/" + relative;
+    DIR *dir = ::opendir(path.c_str());
+
+    if (!dir)
+    {
+        std::cerr << "cannot open directory " << path << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+
+    while (struct dirent *entry = ::readdir(dir))
+    {
+        const std::string name = entry->d_name;
+
+        if (name == "." || name == "..")
+        {
+            continue;
+        }
+
+        const std::string child =
+            relative.empty() ? name : relative + "/" + name;
+        struct stat st;
+
+        if (::stat((root + "/" + child).c_str(), &st) != 0)
+        {
+            std::cerr << "cannot stat " << root << "/" << child << std::endl;
+            ok = false;
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            ok = add_tree(writer, root, child) && ok;
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            std::ifstream file((root + "/" + child).c_str(),
+                               std::ios::in | std::ios::binary);
+            std::ostringstream contents;
+            contents << file.rdbuf();
+
+            if (!file)
+            {
+                std::cerr << "cannot read " << root << "/" << child
+                          << std::endl;
+                ok = false;
+            }
+
+            writer.add(child, contents.str());
+        }
+    }
+
+    ::closedir(dir);
+    return ok;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <output> <directory>"
+                  << std::endl;
+        return 2;
+    }
+
+    includize::bundle_writer writer;
+
+    if (!add_tree(writer, argv[2], ""))
+    {
+        return 1;
+    }
+
+    if (!writer.write(argv[1]))
+    {
+        std::cerr << "cannot write " << argv[1] << std::endl;
+        return 1;
+    }
+
+    return 0;
+}